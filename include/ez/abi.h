@@ -15,17 +15,77 @@ extern "C" {
 
 #define EZ_CLANG_RPC_ENDPOINT(Name) char *Name(const char *Data, size_t Size)
 
+// Result of wrapper-functions invoked via __ez_clang_rpc_call. It follows the
+// ORC wrapper-function ABI: the blob may live in the inline-heap or in static
+// memory and it's copied into the response after the function returned.
+struct EzClangWrapperResult {
+  char *Data;
+  size_t Size;
+};
+
+typedef struct EzClangWrapperResult EzClangWrapperFn(const char *ArgData,
+                                                     size_t ArgSize);
+
+// Lazy binding slot in the code buffer, written by the host. Target initially
+// points to __ez_clang_lazy_trampoline and is patched on first use.
+struct EzClangLazySlot {
+  uint32_t Target;
+  uint32_t Name; // Address of the NUL-terminated symbol name
+};
+
 // RPC endpoints:
 EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_lookup);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_lookup_slots);
 EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_commit);
 EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_execute);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_call);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_benchmark);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_memory_stats);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_tick_stats);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_load_relocatable);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_execute_async);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_execute_status);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_execute_cancel);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_schedule_start);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_schedule_stop);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_schedule_stats);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_stream_configure);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_stream_stats);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_irq_attach);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_irq_detach);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_trampoline_info);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_trampoline_retarget);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_mem_read);
 EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_mem_read_cstring);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_fault_info);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_dsp_bench);
+EZ_CLANG_RPC_ENDPOINT(__ez_clang_rpc_jumptable_info);
 
 #undef EZ_CLANG_RPC_ENDPOINT
 
+// Returns null if there is no inline-heap or the block doesn't fit
 char *__ez_clang_inline_heap_acquire(size_t Bytes);
 void __ez_clang_report_string(const char *Data, size_t Size);
 void __ez_clang_report_value(uint32_t SeqID, const char *Blob, size_t Size);
+uint32_t __ez_clang_crc32(uint32_t Crc, const char *Data, size_t Size);
+void __ez_clang_yield(void);
+
+// Streaming telemetry (see stream.cpp)
+uint32_t __ez_clang_stream_write(const void *Record);
+uint32_t __ez_clang_stream_space(void);
+
+// DSP benchmark fixtures (see dsp.cpp)
+extern int16_t __ez_clang_dsp_bench_signal[];
+extern int16_t __ez_clang_dsp_bench_coeffs[];
+extern int16_t __ez_clang_dsp_bench_output[];
+extern int16_t __ez_clang_dsp_bench_mat_a[];
+extern int16_t __ez_clang_dsp_bench_mat_b[];
+extern int16_t __ez_clang_dsp_bench_mat_c[];
+extern int16_t __ez_clang_dsp_bench_fft[];
+
+// Lazy binding (see lazy.cpp)
+void __ez_clang_lazy_trampoline(void);
+uint32_t __ez_clang_lazy_resolve(struct EzClangLazySlot *Slot);
 
 #ifdef __cplusplus
 } // extern "C"
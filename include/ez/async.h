@@ -0,0 +1,15 @@
+#ifndef EZ_ASYNC_H
+#define EZ_ASYNC_H
+
+// Run the asynchronous function (if any) until input arrives for the message
+// loop or the function yields back for another reason
+void asyncRunUntilInput();
+
+// Mark the asynchronous function as faulted, if the fault happened inside of
+// it. Returns false otherwise.
+bool asyncFault();
+
+// Forget any asynchronous function, e.g. when a new session starts
+void asyncReset();
+
+#endif // EZ_ASYNC_H
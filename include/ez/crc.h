@@ -0,0 +1,11 @@
+#ifndef EZ_CRC_H
+#define EZ_CRC_H
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32 (IEEE 802.3) with zlib semantics: pass 0 initially and the previous
+// result to continue, i.e. crc32(crc32(0, A), B) == crc32(0, AB)
+uint32_t crc32(uint32_t Crc, const char *Data, size_t Size);
+
+#endif // EZ_CRC_H
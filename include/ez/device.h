@@ -11,8 +11,68 @@ void device_notifyShutdown();
 
 void device_setupSendReceive();
 void device_sendBytes(const char *Buffer, size_t Size);
+
+// Send a sequence of buffers. Small pieces are coalesced, so that a frame
+// header and a short payload go out in a single write.
+struct IOVec {
+  const char *Data;
+  size_t Size;
+};
+void device_sendv(const IOVec Vec[], uint32_t Count);
 bool device_receiveBytes(char Buffer[], uint32_t Count);
+uint32_t device_receiveBytesPartial(char Buffer[], uint32_t Count);
+bool device_receiveReady();
 
 void device_flushReceiveBuffer();
 
+// Typed memory regions for the host to place code and data. Code and data
+// regions subdivide the code buffer, so hosts that only know the code buffer
+// keep working. Regions in different banks sit on separate ports of the bus
+// matrix: instruction fetch from one doesn't stall data access to the other.
+// Regions can be empty.
+enum MemoryRegionKind : uint32_t { RegionCode, RegionData, RegionStack };
+enum MemoryRegionFlags : uint32_t { RegionExec = 1 << 0, RegionWrite = 1 << 1 };
+
+struct MemoryRegion {
+  MemoryRegionKind Kind;
+  uint32_t Bank;
+  uint32_t Flags;
+  char *Begin;
+  char *End;
+};
+
+uint32_t device_getMemoryRegions(const MemoryRegion *Regions[]);
+
+void device_setupCycleCounter();
+uint32_t device_readCycleCounter();
+uint32_t device_getCycleCounterFrequency();
+
+// Cycle counts are only valid for intervals shorter than the counter's range.
+// Measurements check this with a coarse millisecond clock that keeps running
+// (approximately) when the cycle counter wraps.
+uint32_t device_readMillis();
+uint32_t device_getCycleCounterRangeMillis();
+
+// Call Handler from a timer interrupt every PeriodMicros. Returns false if the
+// target has no timer for us. Starting again replaces the previous setup.
+bool device_startPeriodicTimer(uint32_t PeriodMicros, void (*Handler)());
+void device_stopPeriodicTimer();
+
+// Longest period the timer supports, or 0 if the target has no timer for us.
+uint32_t device_getMaxTimerPeriodMicros();
+
+// Hold back the timer interrupt while reading state that its handler updates.
+// A tick that comes due in between runs late, but it isn't lost.
+void device_pausePeriodicTimer();
+void device_resumePeriodicTimer();
+
+// Interrupt handlers from JIT code for peripheral interrupts. Returns 0 if
+// the target doesn't support them. Reserved interrupts belong to the firmware
+// itself, e.g. the transport and the periodic timer.
+uint32_t device_getNumInterrupts();
+uint32_t device_getNumInterruptPriorities();
+bool device_isReservedInterrupt(uint32_t Irq);
+void device_attachInterrupt(uint32_t Irq, uint32_t Priority, void (*Handler)());
+void device_detachInterrupt(uint32_t Irq);
+
 #endif // EZ_DEVICE_H
@@ -0,0 +1,18 @@
+#ifndef EZ_FAULT_H
+#define EZ_FAULT_H
+
+// Value for longjmp() to GlobalAssertionFailureReturnPoint after a fault in
+// JIT code. The error record is in GlobalAssertionFailureBuffer.
+constexpr int FaultErrCode = 2;
+
+// Forget the last fault record, e.g. when a new session starts
+void faultReset();
+
+// Remember the interrupt masks that the device set up for the session. We
+// restore them when we recover from a fault.
+void faultSaveInterruptMasks();
+
+// Common entry for the HardFault handlers of the device variants
+extern "C" void __ez_clang_fault_entry();
+
+#endif // EZ_FAULT_H
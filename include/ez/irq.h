@@ -0,0 +1,7 @@
+#ifndef EZ_IRQ_H
+#define EZ_IRQ_H
+
+// Detach all interrupt handlers from JIT code, e.g. when a new session starts
+void irqReset();
+
+#endif // EZ_IRQ_H
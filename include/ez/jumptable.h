@@ -0,0 +1,10 @@
+#ifndef EZ_JUMPTABLE_H
+#define EZ_JUMPTABLE_H
+
+#include <cstdint>
+
+// Address of the jump table slot (Thumb) for the given symtab entry, or Addr if
+// the symbol has no slot
+uint32_t jumptableLookup(uint32_t SymbolIndex, uint32_t Addr);
+
+#endif // EZ_JUMPTABLE_H
@@ -2,6 +2,7 @@
 #define EZ_PROTOCOL_H
 
 #include "ez/abi.h"
+#include "ez/device.h"
 #include "ez/serialize.h"
 #include "ez/symbols.h"
 
@@ -12,6 +13,19 @@
 // 00000001 00100011 01010111 10111101 10111101 01010111 00100011 00000001
 static const uint64_t SetupMagic = 0x012357BDBD572301ull;
 
+// With EZ_CLANG_FRAME_CRC, each frame ends with a CRC-32 over header and
+// payload. A corrupt frame is answered with Nak (empty payload) and the peer
+// retransmits its last frame. StreamData frames are not retransmitted: stream
+// loss is tolerated and shows as a gap in the record index. The firmware
+// advertises this mode with the __ez_clang_crc32 bootstrap symbol in the Setup
+// message.
+// Four 64-bit fields: total size, op-code, sequence ID, tag address
+constexpr uint32_t MessageHeaderSize = 32;
+
+// Static buffer for RPC requests and responses (defined in driver.cpp)
+constexpr uint32_t MessageBufferSize = 0x400;
+extern char MessageBuffer[MessageBufferSize];
+
 typedef char* RPCEndpoint(const char *Data, size_t Size);
 
 enum EPCOpCode : uint32_t {
@@ -21,7 +35,10 @@ enum EPCOpCode : uint32_t {
   Call,
   ReportValue,
   ReportString,
-  LastOpC = ReportString
+  Nak,
+  StreamData,
+  ResultPart,
+  LastOpC = ResultPart
 };
 
 struct SetupInfo {
@@ -30,6 +47,8 @@ struct SetupInfo {
   uint32_t CodeBufferSize;
   uint32_t NumSymbols;
   const Symbol *Symbols;
+  uint32_t NumRegions;
+  const MemoryRegion *Regions;
 };
 
 struct HeaderInfo {
@@ -37,6 +56,8 @@ struct HeaderInfo {
   uint32_t OpCode;
   uint32_t PayloadBytes;
   RPCEndpoint *Handler;
+  uint32_t FrameBegin;    // Cycle count at the first byte of the frame
+  uint32_t ReceiveCycles; // Spent waiting for the rest of the frame
 };
 
 bool receiveMessage(char Buffer[], uint32_t BufferSize, HeaderInfo &Msg);
@@ -44,6 +65,16 @@ bool receiveMessage(char Buffer[], uint32_t BufferSize, HeaderInfo &Msg);
 void sendMessage(EPCOpCode OpC, uint32_t SeqID, const char Payload[],
                  uint32_t NumArgBytes);
 
+// Send a frame whose payload follows MessageHeaderSize bytes of header room
+// in the same buffer. The header is written in place.
+void sendMessageInPlace(EPCOpCode OpC, uint32_t SeqID, char Frame[],
+                        uint32_t PayloadSize);
+
+// Send a frame whose payload is gathered from up to four separate parts.
+// Fire-and-forget: it's never retransmitted.
+void sendMessagev(EPCOpCode OpC, uint32_t SeqID, const IOVec Payload[],
+                  uint32_t NumParts);
+
 void waitForHandshake();
 
 void sendSetupMessage(char Buffer[], SetupInfo Info);
@@ -10,19 +10,40 @@ extern const char *GlobalResponseBufferEnd;
 
 char *responseAcquire(uint32_t ExpectedBytes);
 char *responseFinalize(char *ResponseEnd);
-const char *responseSetBuffer(char *InputEnd, size_t Capacity);
+const char *responseSetBuffer(char *InputEnd, size_t Capacity,
+                              size_t HeaderRoom = 0,
+                              char *InputBegin = nullptr);
 void responseClearBuffer();
 
+// Multi-part responses: If a response doesn't fit the buffer, the handler can
+// send what it has written so far as a ResultPart message under the request's
+// SeqID and continue at the beginning of the buffer. The final Result message
+// carries the rest and the host concatenates all parts. Errors can't be
+// reported anymore once a part went out, so validate input first. Parts are
+// not retransmitted on Nak.
+void responseSetSeqID(uint32_t SeqID);
+char *responseReserve(char *ResponseEnd, uint32_t Bytes);
+char *responseWriteBytes(char *ResponseEnd, const char *Data, uint32_t Size);
+
 const char *responseGetBuffer();
 const char *responseGetLimit();
 
-char *error(const char *Fmt, ...);
-char *errorEx(char *Buffer, uint32_t Size, const char *Fmt, ...);
+enum ErrorCode : uint32_t {
+#define EZ_ERROR(Name, Template) Name,
+#include "ez/errors.def"
+#undef EZ_ERROR
+};
+
+char *error(ErrorCode Code, uint32_t Arg0 = 0, uint32_t Arg1 = 0,
+            uint32_t Arg2 = 0, uint32_t Arg3 = 0);
+char *errorDetail(ErrorCode Code, const char *Detail, uint32_t DetailSize,
+                  uint32_t Arg0 = 0, uint32_t Arg1 = 0, uint32_t Arg2 = 0,
+                  uint32_t Arg3 = 0);
+char *errorEx(char *Buffer, uint32_t Size, ErrorCode Code, const char *Detail,
+              uint32_t DetailSize, uint32_t Arg0 = 0, uint32_t Arg1 = 0,
+              uint32_t Arg2 = 0, uint32_t Arg3 = 0);
 
 const char *errorGetBuffer(uint32_t &Size);
 char *errorFinalize(uint32_t Length);
 
-uint32_t formatlnBytesHex(char Buffer[], const char *Bytes,
-                          size_t BytesRemaining, size_t LineMax = 0);
-
 #endif // EZ_RESPONSE_H
@@ -0,0 +1,7 @@
+#ifndef EZ_SCHEDULE_H
+#define EZ_SCHEDULE_H
+
+// Stop all periodic functions, e.g. when a new session starts
+void scheduleReset();
+
+#endif // EZ_SCHEDULE_H
@@ -0,0 +1,36 @@
+#ifndef EZ_STATS_H
+#define EZ_STATS_H
+
+#include <cstdint>
+
+// Memory usage statistics for sizing buffers per board from measurements
+struct MemoryStats {
+  uint32_t StackSize;
+  uint32_t StackHighWater;
+  uint32_t CodeBufferSize;
+  uint32_t CodeBufferHighWater;
+  uint32_t MessageBufferSize;
+  uint32_t MessageBufferHighWater;
+  uint32_t HeapArena;
+  uint32_t HeapInUse;
+};
+
+// Cycles spent on requests from decoded header to response handoff. Compare
+// builds with and without EZ_CLANG_RAMFUNC_HOTPATH per board.
+struct TickStats {
+  uint32_t Ticks;
+  uint32_t MinCycles;
+  uint32_t MaxCycles;
+  uint32_t MeanCycles;
+};
+
+void statsPaintStack();
+void statsTrackCodeBuffer(const char *End);
+void statsTrackMessageBuffer(const char *End);
+MemoryStats statsCollect();
+
+void statsTrackTick(uint32_t Cycles);
+void statsResetTicks();
+TickStats statsCollectTicks();
+
+#endif // EZ_STATS_H
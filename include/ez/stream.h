@@ -0,0 +1,15 @@
+#ifndef EZ_STREAM_H
+#define EZ_STREAM_H
+
+// Send full chunks of streamed records as StreamData messages, and partial
+// ones that waited for too long. With Flush, send everything that's pending.
+// Call from the message loop context only.
+void streamDrain(bool Flush);
+
+// Whether a stream is configured, so the idle loop has to keep draining
+bool streamIsActive();
+
+// Stop streaming and drop pending records, e.g. when a new session starts
+void streamReset();
+
+#endif // EZ_STREAM_H
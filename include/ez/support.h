@@ -37,6 +37,21 @@ uint32_t ptr2addr(T *Ptr) {
   return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(Ptr));
 }
 
+// With EZ_CLANG_RAMFUNC_HOTPATH, functions on the message path run from SRAM
+// instead of flash, which has wait states. Startup code copies .ramfunc along
+// with .data. Calls between flash and SRAM are out of range for BL, so they
+// are long calls or go through linker veneers.
+#if defined(EZ_CLANG_RAMFUNC_HOTPATH) && defined(__arm__)
+# define EZ_CLANG_RAMFUNC __attribute__((section(".ramfunc"), noinline, long_call))
+#else
+# define EZ_CLANG_RAMFUNC
+#endif
+
+// Function addresses have the Thumb bit set. Cortex-M can't execute ARM code.
+inline bool isThumbFunction(uint32_t FnAddr) {
+  return (FnAddr & 0x1) == 0x1;
+}
+
 // Return true if the argument is a power of two > 0
 constexpr inline bool is_power_of_2(uint32_t Value) {
   return Value && !(Value & (Value - 1));
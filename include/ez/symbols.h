@@ -14,4 +14,7 @@ uint32_t getBootstrapSymbols(const Symbol *BootstrapSyms[]);
 uint32_t lookupBuiltinSymbol(const char *Data, uint32_t Length);
 uint32_t lookupSymbol(const char *Data, uint32_t Length);
 
+// Like lookupSymbol(), but functions with a jump table slot resolve to the slot
+uint32_t lookupSymbolSlot(const char *Data, uint32_t Length);
+
 #endif // EZ_SYMBOLS_H
@@ -0,0 +1,7 @@
+#ifndef EZ_TRAMPOLINE_H
+#define EZ_TRAMPOLINE_H
+
+// Point all trampolines to the unbound handler, e.g. when a new session starts
+void trampolineReset();
+
+#endif // EZ_TRAMPOLINE_H
@@ -0,0 +1,452 @@
+#ifndef EZ_TRANSPORT_H
+#define EZ_TRANSPORT_H
+
+#include "ez/device.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+//
+// Transport backends for the device layer. A variant picks one as a type alias
+// and forwards the device_* send/receive functions to it. All of this resolves
+// at compile time, there is no virtual dispatch on the hot path.
+//
+
+// Coalesce small pieces in a staging buffer and write whole packets straight
+// from the source. Sink must provide write(const char *, size_t).
+template <typename Sink, size_t StagingSize>
+inline void coalescingSendv(const IOVec Vec[], uint32_t Count) {
+  char Staging[StagingSize];
+  size_t Used = 0;
+  for (uint32_t i = 0; i < Count; i += 1) {
+    const char *Data = Vec[i].Data;
+    size_t Size = Vec[i].Size;
+
+    // Top up the staging buffer
+    size_t Fill = StagingSize - Used;
+    if (Fill > Size)
+      Fill = Size;
+    memcpy(Staging + Used, Data, Fill);
+    Used += Fill;
+    Data += Fill;
+    Size -= Fill;
+    if (Size == 0)
+      continue;
+
+    // Staging buffer is full. Write whole packets directly from the source
+    // and keep the tail for coalescing with the next piece.
+    Sink::write(Staging, Used);
+    size_t Direct = Size - Size % StagingSize;
+    if (Direct > 0)
+      Sink::write(Data, Direct);
+    Used = Size - Direct;
+    memcpy(Staging, Data + Direct, Used);
+  }
+  if (Used > 0)
+    Sink::write(Staging, Used);
+}
+
+// Common implementation for Arduino Stream ports
+template <typename PortT, PortT &Port, size_t StagingSize = 64>
+struct StreamTransport {
+  static void write(const char *Buffer, size_t Size) {
+    Port.write(Buffer, Size);
+  }
+
+  static bool receiveBytes(char Buffer[], uint32_t Count) {
+    uint32_t Received = 0;
+    while (Received < Count) {
+      Received += Port.readBytes(Buffer + Received, Count - Received);
+    }
+    return true;
+  }
+
+  // Read what is available right now, don't block
+  static uint32_t receiveBytesPartial(char Buffer[], uint32_t Count) {
+    uint32_t Available = Port.available();
+    if (Available == 0)
+      return 0;
+    return Port.readBytes(Buffer, Available < Count ? Available : Count);
+  }
+
+  static bool receiveReady() {
+    return Port.available() > 0;
+  }
+
+  static void sendBytes(const char *Buffer, size_t Size) {
+    Port.write(Buffer, Size);
+  }
+
+  static void sendv(const IOVec Vec[], uint32_t Count) {
+    coalescingSendv<StreamTransport, StagingSize>(Vec, Count);
+  }
+
+  static void flushReceiveBuffer() {
+    Port.flush();
+  }
+};
+
+// Hardware UART with a fixed baud rate
+template <typename PortT, PortT &Port, uint32_t BaudRate>
+struct UartTransport : StreamTransport<PortT, Port> {
+  static void begin() {
+    Port.begin(BaudRate);
+  }
+};
+
+// Native USB CDC: the baud rate is set from the host, so we only wait for it
+// to open the port. Coalesce up to one full-speed packet.
+template <typename PortT, PortT &Port>
+struct UsbCdcTransport : StreamTransport<PortT, Port, 64> {
+  static void begin() {
+    Port.begin(9600);
+    while (!Port)
+      ;
+  }
+};
+
+#ifdef EZ_CLANG_HOST
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+
+#include <poll.h>
+#include <unistd.h>
+
+// Loopback for host builds: a byte stream over file descriptors, e.g. the
+// socketpair from a host tool that spawned us. The session ends when the peer
+// closes its end.
+template <int InFd, int OutFd, size_t StagingSize = 512>
+struct FdTransport {
+  static void begin() {}
+
+  static void write(const char *Buffer, size_t Size) {
+    while (Size > 0) {
+      ssize_t Written = ::write(OutFd, Buffer, Size);
+      if (Written <= 0)
+        exit(0);
+      Buffer += Written;
+      Size -= Written;
+    }
+  }
+
+  static bool receiveBytes(char Buffer[], uint32_t Count) {
+    while (Count > 0) {
+      ssize_t Received = ::read(InFd, Buffer, Count);
+      if (Received <= 0)
+        exit(0);
+      Buffer += Received;
+      Count -= Received;
+    }
+    return true;
+  }
+
+  static uint32_t receiveBytesPartial(char Buffer[], uint32_t Count) {
+    pollfd Pfd{InFd, POLLIN, 0};
+    if (::poll(&Pfd, 1, 0) <= 0)
+      return 0;
+    ssize_t Received = ::read(InFd, Buffer, Count);
+    if (Received <= 0)
+      exit(0);
+    return Received;
+  }
+
+  static bool receiveReady() {
+    pollfd Pfd{InFd, POLLIN, 0};
+    return ::poll(&Pfd, 1, 0) > 0;
+  }
+
+  static void sendBytes(const char *Buffer, size_t Size) {
+    write(Buffer, Size);
+  }
+
+  static void sendv(const IOVec Vec[], uint32_t Count) {
+    coalescingSendv<FdTransport, StagingSize>(Vec, Count);
+  }
+
+  static void flushReceiveBuffer() {
+    char Scratch[64];
+    while (receiveBytesPartial(Scratch, sizeof(Scratch)) > 0)
+      ;
+  }
+};
+
+// Link emulation for host builds: Model the wire between the host tools and
+// the firmware process, so benchmarks of protocol changes see real wire time
+// instead of memcpy speed. The model is picked up from the environment:
+//
+//   EZ_CLANG_LINK=uart|usb    Model (default: none, i.e. pass-through)
+//   EZ_CLANG_LINK_BAUD        UART baud rate with 8N1 framing (default 9600,
+//                             like the programming port of the Due)
+//   EZ_CLANG_LINK_PACKETS     USB full-speed: 64-byte packets per 1ms frame
+//                             (default 19, the bulk transfer maximum)
+//   EZ_CLANG_LINK_LATENCY_US  Extra round-trip latency, e.g. a USB-UART bridge
+//   EZ_CLANG_LINK_BER         Bit-error rate in both directions, e.g. 1e-6
+//   EZ_CLANG_LINK_SEED        Seed for the bit errors (default 1)
+//
+// Outgoing bytes block the firmware until they are on the wire. Incoming bytes
+// are timestamped when the firmware polls for them, so the model is accurate
+// as long as the firmware waits for input in the message loop.
+//
+struct LinkModel {
+  enum Kind { None, Uart, Usb };
+
+  Kind Model = None;
+  uint64_t ByteNs = 0;           // UART: 10 bits per byte
+  uint32_t PacketsPerFrame = 19; // USB
+  uint64_t LatencyNs = 0;
+  double BitErrorRate = 0.0;
+  uint64_t Seed = 1;
+
+  static constexpr uint32_t PacketSize = 64;
+  static constexpr uint64_t FrameNs = 1000000;
+
+  static LinkModel fromEnvironment() {
+    LinkModel M;
+    const char *Model = getenv("EZ_CLANG_LINK");
+    if (Model && strcmp(Model, "uart") == 0)
+      M.Model = Uart;
+    else if (Model && strcmp(Model, "usb") == 0)
+      M.Model = Usb;
+    uint64_t Baud = 9600;
+    if (const char *Value = getenv("EZ_CLANG_LINK_BAUD"))
+      Baud = strtoul(Value, nullptr, 10);
+    M.ByteNs = 10000000000ull / (Baud ? Baud : 9600);
+    if (const char *Packets = getenv("EZ_CLANG_LINK_PACKETS"))
+      M.PacketsPerFrame = strtoul(Packets, nullptr, 10);
+    if (M.PacketsPerFrame == 0)
+      M.PacketsPerFrame = 1;
+    if (const char *Latency = getenv("EZ_CLANG_LINK_LATENCY_US"))
+      M.LatencyNs = strtoull(Latency, nullptr, 10) * 1000;
+    if (const char *Ber = getenv("EZ_CLANG_LINK_BER"))
+      M.BitErrorRate = strtod(Ber, nullptr);
+    if (const char *Seed = getenv("EZ_CLANG_LINK_SEED"))
+      M.Seed = strtoull(Seed, nullptr, 10) | 1;
+    return M;
+  }
+
+  // Bytes go over the wire in units: USB packets or short runs of UART bytes
+  uint32_t unitSize() const { return Model == Usb ? PacketSize : 16; }
+};
+
+// One direction of the emulated link
+class LinkWire {
+public:
+  void init(const LinkModel &M, uint64_t Seed) {
+    Rng = Seed;
+    NextErrorBit = sampleErrorDistance(M);
+  }
+
+  // Time when a unit of bytes that enters the wire at Now is complete on the
+  // other side
+  uint64_t schedule(const LinkModel &M, uint64_t Now, uint32_t Size) {
+    if (M.Model == LinkModel::Uart) {
+      FreeAt = (Now > FreeAt ? Now : FreeAt) + Size * M.ByteNs;
+      return FreeAt;
+    }
+    // USB: The host controller schedules packets at the next frame boundary
+    uint64_t F = Now / LinkModel::FrameNs + 1;
+    if (F <= Frame) {
+      F = Frame;
+      if (PacketsInFrame >= M.PacketsPerFrame)
+        F += 1;
+    }
+    if (F != Frame) {
+      Frame = F;
+      PacketsInFrame = 0;
+    }
+    PacketsInFrame += 1;
+    return Frame * LinkModel::FrameNs;
+  }
+
+  // Flip bits at the configured error rate
+  void corrupt(const LinkModel &M, char *Data, uint32_t Size) {
+    if (M.BitErrorRate <= 0.0)
+      return;
+    uint64_t Bits = Size * 8ull;
+    uint64_t Pos = NextErrorBit;
+    while (Pos < Bits) {
+      Data[Pos / 8] ^= static_cast<char>(1 << (Pos % 8));
+      Pos += 1 + sampleErrorDistance(M);
+    }
+    NextErrorBit = Pos - Bits;
+  }
+
+private:
+  // Geometric distribution: number of good bits before the next error
+  uint64_t sampleErrorDistance(const LinkModel &M) {
+    if (M.BitErrorRate <= 0.0)
+      return UINT64_MAX;
+    Rng ^= Rng >> 12;
+    Rng ^= Rng << 25;
+    Rng ^= Rng >> 27;
+    double U = ((Rng * 0x2545F4914F6CDD1Dull) >> 11) * (1.0 / 9007199254740992.0);
+    return static_cast<uint64_t>(log1p(-U) / log1p(-M.BitErrorRate));
+  }
+
+  uint64_t FreeAt = 0;
+  uint64_t Frame = 0;
+  uint32_t PacketsInFrame = 0;
+  uint64_t NextErrorBit = 0;
+  uint64_t Rng = 1;
+};
+
+inline uint64_t linkNowNs() {
+  timespec Now;
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  return Now.tv_sec * 1000000000ull + Now.tv_nsec;
+}
+
+inline void linkSleepUntil(uint64_t Ns) {
+  timespec Deadline{static_cast<time_t>(Ns / 1000000000ull),
+                    static_cast<long>(Ns % 1000000000ull)};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Deadline, nullptr) != 0)
+    ;
+}
+
+// Wrap a byte stream transport with the link model. Incoming bytes wait in a
+// queue of units until the wire delivered them.
+template <typename Inner, size_t StagingSize = 512>
+struct EmulatedTransport {
+  struct Unit {
+    uint64_t ReadyAt;
+    uint32_t Size;
+    uint32_t Pos;
+    char Data[LinkModel::PacketSize];
+  };
+
+  static constexpr uint32_t NumUnits = 256;
+
+  struct State {
+    LinkModel Model;
+    LinkWire Tx;
+    LinkWire Rx;
+    Unit Queue[NumUnits];
+    uint32_t Head = 0; // Free-running
+    uint32_t Tail = 0;
+  };
+
+  static State &state() {
+    static State S;
+    return S;
+  }
+
+  static void begin() {
+    Inner::begin();
+    State &S = state();
+    S.Model = LinkModel::fromEnvironment();
+    S.Tx.init(S.Model, S.Model.Seed);
+    S.Rx.init(S.Model, S.Model.Seed * 0x9E3779B97F4A7C15ull | 1);
+  }
+
+  static void write(const char *Buffer, size_t Size) {
+    State &S = state();
+    if (S.Model.Model == LinkModel::None)
+      return Inner::write(Buffer, Size);
+    char Data[LinkModel::PacketSize];
+    while (Size > 0) {
+      uint32_t Chunk = Size < S.Model.unitSize() ? Size : S.Model.unitSize();
+      memcpy(Data, Buffer, Chunk);
+      S.Tx.corrupt(S.Model, Data, Chunk);
+      linkSleepUntil(S.Tx.schedule(S.Model, linkNowNs(), Chunk));
+      Inner::write(Data, Chunk);
+      Buffer += Chunk;
+      Size -= Chunk;
+    }
+  }
+
+  // Move incoming bytes into the queue and stamp them with the time they
+  // leave the wire. If Block is set, wait for at least one byte.
+  static void pump(bool Block) {
+    State &S = state();
+    uint32_t UnitSize = S.Model.unitSize();
+    uint32_t FreeUnits = NumUnits - (S.Head - S.Tail);
+    if (FreeUnits == 0)
+      return;
+    char Scratch[NumUnits * LinkModel::PacketSize];
+    uint32_t Capacity = FreeUnits * UnitSize;
+    uint32_t Received = 0;
+    if (Block) {
+      Inner::receiveBytes(Scratch, 1);
+      Received = 1;
+    }
+    Received += Inner::receiveBytesPartial(Scratch + Received, Capacity - Received);
+    uint64_t Now = linkNowNs();
+    for (uint32_t Offset = 0; Offset < Received; Offset += UnitSize) {
+      uint32_t Size = Received - Offset < UnitSize ? Received - Offset : UnitSize;
+      Unit &U = S.Queue[S.Head % NumUnits];
+      memcpy(U.Data, Scratch + Offset, Size);
+      S.Rx.corrupt(S.Model, U.Data, Size);
+      U.ReadyAt = S.Rx.schedule(S.Model, Now, Size) + S.Model.LatencyNs;
+      U.Size = Size;
+      U.Pos = 0;
+      S.Head += 1;
+    }
+  }
+
+  // Copy out of the front unit and drop it when it's consumed
+  static uint32_t consume(char *Buffer, uint32_t Count) {
+    State &S = state();
+    Unit &U = S.Queue[S.Tail % NumUnits];
+    uint32_t Size = U.Size - U.Pos < Count ? U.Size - U.Pos : Count;
+    memcpy(Buffer, U.Data + U.Pos, Size);
+    U.Pos += Size;
+    if (U.Pos == U.Size)
+      S.Tail += 1;
+    return Size;
+  }
+
+  static bool receiveBytes(char Buffer[], uint32_t Count) {
+    State &S = state();
+    if (S.Model.Model == LinkModel::None)
+      return Inner::receiveBytes(Buffer, Count);
+    while (Count > 0) {
+      if (S.Head == S.Tail)
+        pump(true);
+      linkSleepUntil(S.Queue[S.Tail % NumUnits].ReadyAt);
+      uint32_t Size = consume(Buffer, Count);
+      Buffer += Size;
+      Count -= Size;
+    }
+    return true;
+  }
+
+  static uint32_t receiveBytesPartial(char Buffer[], uint32_t Count) {
+    State &S = state();
+    if (S.Model.Model == LinkModel::None)
+      return Inner::receiveBytesPartial(Buffer, Count);
+    pump(false);
+    uint64_t Now = linkNowNs();
+    uint32_t Received = 0;
+    while (Received < Count && S.Head != S.Tail &&
+           S.Queue[S.Tail % NumUnits].ReadyAt <= Now)
+      Received += consume(Buffer + Received, Count - Received);
+    return Received;
+  }
+
+  static bool receiveReady() {
+    State &S = state();
+    if (S.Model.Model == LinkModel::None)
+      return Inner::receiveReady();
+    pump(false);
+    return S.Head != S.Tail && S.Queue[S.Tail % NumUnits].ReadyAt <= linkNowNs();
+  }
+
+  static void sendBytes(const char *Buffer, size_t Size) {
+    write(Buffer, Size);
+  }
+
+  static void sendv(const IOVec Vec[], uint32_t Count) {
+    coalescingSendv<EmulatedTransport, StagingSize>(Vec, Count);
+  }
+
+  static void flushReceiveBuffer() {
+    char Scratch[64];
+    while (receiveBytesPartial(Scratch, sizeof(Scratch)) > 0)
+      ;
+  }
+};
+#endif
+
+#endif // EZ_TRANSPORT_H
@@ -0,0 +1,79 @@
+#ifndef EZ_VECTORS_H
+#define EZ_VECTORS_H
+
+#include "ez/support.h"
+
+#include <cstdint>
+
+//
+// Vector table in SRAM for interrupt handlers from JIT code. A variant
+// includes this after the CMSIS device header and forwards the device_*
+// interrupt functions to it. The table is a copy of the active one in flash
+// and it replaces it via VTOR on first use, so handlers of the Arduino core
+// keep working. Detaching restores the original handler.
+//
+// Entries 0 to 15 are the initial stack pointer and system exceptions, the
+// peripheral interrupts follow.
+//
+
+// VTOR needs the table aligned to its size rounded up to a power of two
+constexpr uint32_t vectorTableAlignment(uint32_t Bytes, uint32_t Align = 128) {
+  return Align >= Bytes ? Align : vectorTableAlignment(Bytes, Align * 2);
+}
+
+template <uint32_t NumIrqs>
+class RamVectorTable {
+public:
+  typedef void (*Vector)();
+
+  static void attach(uint32_t Irq, uint32_t Priority, Vector Handler) {
+    IRQn_Type IRQn = static_cast<IRQn_Type>(Irq);
+    NVIC_DisableIRQ(IRQn);
+    install();
+    Table[SystemVectors + Irq] = Handler;
+    NVIC_SetPriority(IRQn, Priority);
+    NVIC_ClearPendingIRQ(IRQn);
+    __DSB();
+    NVIC_EnableIRQ(IRQn);
+  }
+
+  static void detach(uint32_t Irq) {
+    IRQn_Type IRQn = static_cast<IRQn_Type>(Irq);
+    NVIC_DisableIRQ(IRQn);
+    __DSB();
+    __ISB();
+    if (Original)
+      Table[SystemVectors + Irq] = Original[SystemVectors + Irq];
+    NVIC_ClearPendingIRQ(IRQn);
+  }
+
+private:
+  static constexpr uint32_t SystemVectors = 16;
+  static constexpr uint32_t NumVectors = SystemVectors + NumIrqs;
+
+  static void install() {
+    if (Original)
+      return;
+    Original = reinterpret_cast<const Vector *>(addr2ptr(SCB->VTOR));
+    for (uint32_t i = 0; i < NumVectors; i += 1)
+      Table[i] = Original[i];
+    __DSB();
+    SCB->VTOR = ptr2addr(Table);
+    __DSB();
+    __ISB();
+  }
+
+  static Vector Table[NumVectors];
+  static const Vector *Original;
+};
+
+template <uint32_t NumIrqs>
+typename RamVectorTable<NumIrqs>::Vector RamVectorTable<NumIrqs>::Table
+    [RamVectorTable<NumIrqs>::NumVectors] __attribute__((aligned(
+        vectorTableAlignment(RamVectorTable<NumIrqs>::NumVectors * 4))));
+
+template <uint32_t NumIrqs>
+const typename RamVectorTable<NumIrqs>::Vector
+    *RamVectorTable<NumIrqs>::Original = nullptr;
+
+#endif // EZ_VECTORS_H
@@ -0,0 +1,24 @@
+#ifndef EZ_VENEER_H
+#define EZ_VENEER_H
+
+#include <cstdint>
+
+// Veneer that branches to an absolute address. Relocatable modules use it for
+// branches that don't reach their target, trampolines and jump table slots
+// have the same layout. It's Thumb-1 code, so it runs on Cortex-M0+ as well
+// and it preserves all registers:
+//   0: b403      push {r0, r1}
+//   2: 4801      ldr  r0, [pc, #4]   ; Target
+//   4: 9001      str  r0, [sp, #4]
+//   6: bd01      pop  {r0, pc}
+//   8: .word     Target
+constexpr uint32_t VeneerSize = 12;
+
+// Offset of the target word. Retargeting a veneer is a single aligned store.
+constexpr uint32_t VeneerTargetOffset = 8;
+
+// Write a veneer to V (4-byte aligned) that branches to the Thumb address of
+// Target
+void writeVeneer(char *V, uint32_t Target);
+
+#endif // EZ_VENEER_H
@@ -70,6 +70,7 @@ def adafruit_metro_m0_relink_after_build(target, source, env):
     "RELINK_DIR": relink_dir,
     "TOOLS_DIR": tools_dir,
     "BUILD_DIR": build_dir,
+    "EZ_STDLIB": env.GetProjectOption("custom_ez_stdlib", "resident"),
   }
   make_env.update(make_env_ext)
 
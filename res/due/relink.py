@@ -37,6 +37,20 @@ def due_relink_after_build(target, source, env):
           "Please set your 'ARDUINO_SAM' environment variable appropriately.")
     exit(1)
 
+  # Makefile needs libarm_cortexM3l_math.a. CMSIS 5 keeps it next to the
+  # CMSIS/DSP/Include headers, CMSIS 4 had it in CMSIS/Lib.
+  cmsis_dir = make_env.get("CMSIS_LIB")
+  if not cmsis_dir:
+    cmsis_root = make_env["HOME"] + "/.platformio/packages/framework-cmsis/CMSIS"
+    cmsis_dir = cmsis_root + "/DSP/Lib"
+    if not os.path.isdir(cmsis_dir):
+      cmsis_dir = cmsis_root + "/Lib"
+  cmsis_lib = os.path.join(cmsis_dir, "GCC", "libarm_cortexM3l_math.a")
+  if not os.path.isfile(cmsis_lib) or not os.path.isabs(cmsis_dir):
+    print("Cannot find CMSIS-DSP library:", cmsis_lib,
+          "Please set your 'CMSIS_LIB' environment variable appropriately.")
+    exit(1)
+
   # We will use existing build artifacts from platformio build root
   build_dir = os.path.abspath(".pio/build/" + bin_info.dir.name)
   if not os.path.isdir(build_dir):
@@ -67,9 +81,11 @@ def due_relink_after_build(target, source, env):
     "NM": os.path.join(llvm_binary_dir, "llvm-nm"),
     "OBJCOPY": os.path.join(llvm_binary_dir, "llvm-objcopy"),
     "DEVICE_LIB_DIR": os.path.join(arduino_dir, "variants", "arduino_due_x"),
+    "CMSIS_LIB_DIR": os.path.join(cmsis_dir, "GCC"),
     "RELINK_DIR": relink_dir,
     "TOOLS_DIR": tools_dir,
     "BUILD_DIR": build_dir,
+    "EZ_STDLIB": env.GetProjectOption("custom_ez_stdlib", "resident"),
   })
 
   # Run Makefile in resource directory
@@ -102,6 +118,10 @@ def due_relink_after_build(target, source, env):
   if os.path.isfile(final_bin):
     os.remove(final_bin)
 
+  # The host loads the stdlib from these archives on demand
+  if make_env["EZ_STDLIB"] == "runtime":
+    print("Runtime stdlib archives listed in", relink_dir + "/runtime-libs.txt")
+
   # Done
   print("Relink succeeded")
 
@@ -0,0 +1,6 @@
+#!/usr/bin/python3
+Import("env")
+
+# Addresses are exchanged as 32-bit values in the RPC protocol. Without PIE,
+# code and static data of the host firmware stay in the lower 4GB.
+env.Append(LINKFLAGS=["-no-pie"])
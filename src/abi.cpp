@@ -1,38 +1,51 @@
 #include "ez/abi.h"
 
 #include "ez/assert.h"
+#include "ez/crc.h"
+#include "ez/device.h"
 #include "ez/response.h"
 #include "ez/protocol.h"
 #include "ez/serialize.h"
+#include "ez/stats.h"
 #include "ez/support.h"
 #include "ez/symbols.h"
 
-#include <cinttypes>
 #include <cstdint>
 #include <cstring>
 
 extern "C" {
 
-char *__ez_clang_rpc_lookup(const char *Data, size_t Size) {
+typedef uint32_t LookupFn(const char *Data, uint32_t Length);
+
+static uint32_t lookupDirect(const char *Data, uint32_t Length) {
+  if (uint32_t Addr = lookupBuiltinSymbol(Data, Length))
+    return Addr;
+  return lookupSymbol(Data, Length);
+}
+
+// Runtime functions can be exported as well, so they get a slot too
+static uint32_t lookupSlot(const char *Data, uint32_t Length) {
+  if (uint32_t Addr = lookupSymbolSlot(Data, Length))
+    return Addr;
+  return lookupBuiltinSymbol(Data, Length);
+}
+
+static char *lookupSymbols(const char *Data, size_t Size, LookupFn *Lookup) {
   const char *DataBegin = Data;
 
   uint32_t SymbolsRemaining;
   Data += readSize(Data, SymbolsRemaining);
 
-  char *Response = responseAcquire(1 + 8 + SymbolsRemaining * 8);
+  char *Response = responseAcquire(1 + 8);
   Response += writeBool(Response, false); // HasError
   Response += writeUInt64(Response, SymbolsRemaining);
 
+  // Large lookups go out in multiple parts
   while (SymbolsRemaining > 0) {
     uint32_t Length;
     Data += readSize(Data, Length);
-    if (uint32_t Addr = lookupBuiltinSymbol(Data, Length)) {
-      Response += writeUInt64(Response, Addr);
-    } else if (uint32_t Addr = lookupSymbol(Data, Length)) {
-      Response += writeUInt64(Response, Addr);
-    } else {
-      Response += writeUInt64(Response, 0);
-    }
+    Response = responseReserve(Response, 8);
+    Response += writeUInt64(Response, Lookup(Data, Length));
     Data += Length;
     SymbolsRemaining -= 1;
   }
@@ -41,6 +54,35 @@ char *__ez_clang_rpc_lookup(const char *Data, size_t Size) {
   return responseFinalize(Response);
 }
 
+char *__ez_clang_rpc_lookup(const char *Data, size_t Size) {
+  return lookupSymbols(Data, Size, lookupDirect);
+}
+
+// Same input and output as lookup, but functions resolve to their slot in the
+// ABI-stable jump table, if they have one
+char *__ez_clang_rpc_lookup_slots(const char *Data, size_t Size) {
+  return lookupSymbols(Data, Size, lookupSlot);
+}
+
+// Copy segment content and zero-fill the rest. Code segments go to the code
+// buffer in SRAM, so word-wise copying is safe on every target as long as both
+// sides are aligned.
+EZ_CLANG_RAMFUNC
+static void commitSegment(char *Target, const char *Content,
+                          uint32_t ContentSize, uint32_t SegmentSize) {
+  uint32_t i = 0;
+  if (((ptr2addr(Target) | ptr2addr(Content)) & 0x3) == 0) {
+    uint32_t *TargetWords = reinterpret_cast<uint32_t *>(Target);
+    const uint32_t *ContentWords = reinterpret_cast<const uint32_t *>(Content);
+    for (; i + 4 <= ContentSize; i += 4)
+      *TargetWords++ = *ContentWords++;
+  }
+  for (; i < ContentSize; i += 1)
+    Target[i] = Content[i];
+  for (; i < SegmentSize; i += 1)
+    Target[i] = 0;
+}
+
 char *__ez_clang_rpc_commit(const char *Data, size_t Size) {
   const char *DataBegin = Data;
 
@@ -53,9 +95,8 @@ char *__ez_clang_rpc_commit(const char *Data, size_t Size) {
     Data += readSize(Data, SegmentSize);
     uint32_t ContentSize;
     Data += readSize(Data, ContentSize);
-    memcpy(addr2ptr(TargetAddr), Data, ContentSize);
-    memset(addr2ptr(TargetAddr + ContentSize), 0,
-           SegmentSize - ContentSize);
+    commitSegment(addr2ptr(TargetAddr), Data, ContentSize, SegmentSize);
+    statsTrackCodeBuffer(addr2ptr(TargetAddr + SegmentSize));
     Data += ContentSize;
     SegmentsRemaining -= 1;
   }
@@ -70,32 +111,286 @@ char *__ez_clang_rpc_commit(const char *Data, size_t Size) {
 const char *InlineHeapPtr = nullptr;
 const char *InlineHeapEnd = nullptr;
 
+// Provide the remaining MessageBuffer space as an inline-heap for the function;
+// it's accessible from JITed code via __ez_clang_inline_heap_acquire()
+static void inlineHeapBegin(const char *ResponseEnd) {
+  InlineHeapPtr = align_ptr<32>(ResponseEnd);
+  InlineHeapEnd = align_ptr<32>(responseGetLimit());
+}
+
+static void inlineHeapEnd() {
+  InlineHeapPtr = nullptr;
+  InlineHeapEnd = nullptr;
+}
+
 char *__ez_clang_rpc_execute(const char *Data, size_t Size) {
   assert(Size == 8, "Invalid input length");
 
   uint32_t FnAddr;
   Data += readAddr(Data, FnAddr);
-  if ((FnAddr & 0x1) != 0x1)
-    return error("Attempted to call non-Thumb function @ 0x%08" PRIx32, FnAddr);
+  if (!isThumbFunction(FnAddr))
+    return error(ErrNonThumbFunction, FnAddr);
 
   typedef void ClingFn_t(void *);
   ClingFn_t *Fn = (ClingFn_t *)((uintptr_t)FnAddr);
 
-  // Acquire response memory so we can provide the remaining MessageBuffer space
-  // as an inline-heap for the function; it's accessible from JITed code via
-  // __ez_clang_inline_heap_acquire()
+  // Acquire response memory so we can provide the rest as inline-heap
   constexpr uint32_t ResponseSize = 1;
   char *Resp = responseAcquire(ResponseSize);
-  InlineHeapPtr = align_ptr<32>(Resp + ResponseSize);
-  InlineHeapEnd = align_ptr<32>(responseGetLimit());
+  inlineHeapBegin(Resp + ResponseSize);
 
   // FIXME: Drop the unused parameter in generated wrappers
   uint64_t Unused = 0;
   Fn((void *)&Unused);
 
-  InlineHeapPtr = nullptr;
-  InlineHeapEnd = nullptr;
+  inlineHeapEnd();
+  Resp += writeBool(Resp, false); // HasError
+  return responseFinalize(Resp);
+}
+
+// Invoke a wrapper-function with an argument blob and return its result blob
+// in the same response. Input: function address, argument blob (size-prefixed).
+// Output: HasError, result blob (size-prefixed).
+char *__ez_clang_rpc_call(const char *Data, size_t Size) {
+  const char *DataBegin = Data;
+
+  uint32_t FnAddr;
+  Data += readAddr(Data, FnAddr);
+  if (!isThumbFunction(FnAddr))
+    return error(ErrNonThumbFunction, FnAddr);
+
+  // The argument blob is passed straight from the MessageBuffer
+  uint32_t ArgSize;
+  Data += readSize(Data, ArgSize);
+  assert(Data + ArgSize == DataBegin + Size, "Invalid input length");
+
+  EzClangWrapperFn *Fn = (EzClangWrapperFn *)((uintptr_t)FnAddr);
+
+  constexpr uint32_t ResponseHeaderSize = 1 + 8;
+  char *Resp = responseAcquire(ResponseHeaderSize);
+  inlineHeapBegin(Resp + ResponseHeaderSize);
+
+  EzClangWrapperResult Result = Fn(Data, ArgSize);
+
+  inlineHeapEnd();
+  const char *RespLimit = responseGetLimit();
+  if (Result.Size > static_cast<size_t>(RespLimit - Resp - ResponseHeaderSize))
+    return error(ErrWrapperResultTooLarge, Result.Size);
+
+  Resp += writeBool(Resp, false); // HasError
+  Resp += writeUInt64(Resp, Result.Size);
+
+  // Result blobs in the inline-heap are behind the header; move them in front
+  char *Blob = responseAcquire(Result.Size);
+  if (Result.Size > 0)
+    memmove(Blob, Result.Data, Result.Size);
+  return responseFinalize(Blob + Result.Size);
+}
+
+static void sortSamples(uint32_t *Samples, uint32_t Count) {
+  for (uint32_t i = 1; i < Count; i += 1) {
+    uint32_t Value = Samples[i];
+    uint32_t j = i;
+    for (; j > 0 && Samples[j - 1] > Value; j -= 1)
+      Samples[j] = Samples[j - 1];
+    Samples[j] = Value;
+  }
+}
+
+static uint32_t sqrtUInt64(uint64_t Value) {
+  uint64_t Root = 0;
+  uint64_t Bit = 1ull << 62;
+  while (Bit > Value)
+    Bit >>= 2;
+  while (Bit != 0) {
+    if (Value >= Root + Bit) {
+      Value -= Root + Bit;
+      Root = (Root >> 1) + Bit;
+    } else {
+      Root >>= 1;
+    }
+    Bit >>= 2;
+  }
+  return Root;
+}
+
+// Run a function repeatedly and measure the cycles per iteration on-device.
+// Input: function address, iterations, warm-up iterations, return samples.
+// Output: HasError, iterations, counter frequency, min, median, max, mean,
+// standard deviation and (optionally) the raw samples (size-prefixed).
+char *__ez_clang_rpc_benchmark(const char *Data, size_t Size) {
+  assert(Size == 8 + 8 + 8 + 1, "Invalid input length");
+
+  uint32_t FnAddr;
+  Data += readAddr(Data, FnAddr);
+  uint32_t Iterations;
+  Data += readSize(Data, Iterations);
+  uint32_t WarmupIterations;
+  Data += readSize(Data, WarmupIterations);
+  uint8_t ReturnSamples;
+  Data += readUInt8(Data, ReturnSamples);
+
+  if (!isThumbFunction(FnAddr))
+    return error(ErrNonThumbFunction, FnAddr);
+  if (Iterations == 0)
+    return error(ErrBenchmarkNoIterations);
+
+  // Same calling convention as __ez_clang_rpc_execute
+  typedef void ClingFn_t(void *);
+  ClingFn_t *Fn = (ClingFn_t *)((uintptr_t)FnAddr);
+
+  // Samples are recorded at the end of the response memory. The space in
+  // between serves as inline-heap, which is reset for each iteration.
+  uint32_t ResponseSize = 1 + 7 * 8;
+  if (ReturnSamples)
+    ResponseSize += 8 + 8 * Iterations;
+  char *RespBegin = const_cast<char *>(responseGetBuffer());
+  uint32_t Capacity = responseGetLimit() - RespBegin;
+  if (ResponseSize + 4 * Iterations + 4 > Capacity)
+    return error(ErrBenchmarkTooManyIterations, Iterations);
+
+  char *Resp = responseAcquire(ResponseSize);
+  char *SamplesEnd = const_cast<char *>(responseGetLimit());
+  uint32_t *Samples = reinterpret_cast<uint32_t *>(
+      addr2ptr(ptr2addr(SamplesEnd - 4 * Iterations) & ~0x3u));
+  statsTrackMessageBuffer(SamplesEnd);
+
+  // Calibrate the overhead of reading the counter
+  uint32_t Overhead = UINT32_MAX;
+  for (uint32_t i = 0; i < 8; i += 1) {
+    uint32_t Begin = device_readCycleCounter();
+    uint32_t End = device_readCycleCounter();
+    if (End - Begin < Overhead)
+      Overhead = End - Begin;
+  }
+
+  uint64_t Unused = 0;
+  for (uint32_t i = 0; i < WarmupIterations; i += 1) {
+    inlineHeapBegin(Resp + ResponseSize);
+    InlineHeapEnd = reinterpret_cast<char *>(Samples);
+    Fn((void *)&Unused);
+  }
+
+  uint32_t RangeMillis = device_getCycleCounterRangeMillis();
+  for (uint32_t i = 0; i < Iterations; i += 1) {
+    inlineHeapBegin(Resp + ResponseSize);
+    InlineHeapEnd = reinterpret_cast<char *>(Samples);
+    uint32_t BeginMillis = device_readMillis();
+    uint32_t Begin = device_readCycleCounter();
+    Fn((void *)&Unused);
+    uint32_t End = device_readCycleCounter();
+    uint32_t Millis = device_readMillis() - BeginMillis;
+    if (Millis >= RangeMillis) {
+      inlineHeapEnd();
+      return error(ErrCycleCounterRange, Millis, RangeMillis);
+    }
+    uint32_t Cycles = End - Begin;
+    Samples[i] = Cycles > Overhead ? Cycles - Overhead : 0;
+  }
+  inlineHeapEnd();
+
+  uint64_t Sum = 0;
+  for (uint32_t i = 0; i < Iterations; i += 1)
+    Sum += Samples[i];
+  uint32_t Mean = Sum / Iterations;
+
+  uint64_t SumSquares = 0;
+  for (uint32_t i = 0; i < Iterations; i += 1) {
+    int64_t Delta = static_cast<int64_t>(Samples[i]) - Mean;
+    SumSquares += Delta * Delta;
+  }
+  uint32_t StdDev = sqrtUInt64(SumSquares / Iterations);
+
+  // Emit raw samples in measurement order, before sorting them for the median.
+  // They are written in front of the samples buffer, so there is no overlap.
+  char *Stats = Resp + 1 + 8 + 8;
+  char *Raw = Resp + 1 + 7 * 8;
+  if (ReturnSamples) {
+    Raw += writeUInt64(Raw, Iterations);
+    for (uint32_t i = 0; i < Iterations; i += 1)
+      Raw += writeUInt64(Raw, Samples[i]);
+  }
+
+  sortSamples(Samples, Iterations);
+  Stats += writeUInt64(Stats, Samples[0]);
+  Stats += writeUInt64(Stats, Samples[Iterations / 2]);
+  Stats += writeUInt64(Stats, Samples[Iterations - 1]);
+  Stats += writeUInt64(Stats, Mean);
+  Stats += writeUInt64(Stats, StdDev);
+
+  Resp += writeBool(Resp, false); // HasError
+  Resp += writeUInt64(Resp, Iterations);
+  Resp += writeUInt64(Resp, device_getCycleCounterFrequency());
+  return responseFinalize(Raw);
+}
+
+// Report memory usage: stack high-water mark (from painting at boot), code
+// buffer and message buffer high-water marks, and heap usage.
+// Output: HasError, 8 values as (size, used) pairs.
+char *__ez_clang_rpc_memory_stats(const char *Data, size_t Size) {
+  assert(Size == 0, "Invalid input length");
+
+  MemoryStats Stats = statsCollect();
+  char *Resp = responseAcquire(1 + 8 * 8);
+  Resp += writeBool(Resp, false); // HasError
+  Resp += writeUInt64(Resp, Stats.StackSize);
+  Resp += writeUInt64(Resp, Stats.StackHighWater);
+  Resp += writeUInt64(Resp, Stats.CodeBufferSize);
+  Resp += writeUInt64(Resp, Stats.CodeBufferHighWater);
+  Resp += writeUInt64(Resp, Stats.MessageBufferSize);
+  Resp += writeUInt64(Resp, Stats.MessageBufferHighWater);
+  Resp += writeUInt64(Resp, Stats.HeapArena);
+  Resp += writeUInt64(Resp, Stats.HeapInUse);
+  return responseFinalize(Resp);
+}
+
+// Report cycles per request in the message loop, optionally reset afterwards.
+// A request counts from its first byte to the return of its handler, so this
+// includes parsing the frame, but not the time spent waiting for its bytes or
+// sending the response.
+// Input: Reset. Output: HasError, hot path in SRAM, counter frequency, ticks,
+// min, max and mean cycles.
+char *__ez_clang_rpc_tick_stats(const char *Data, size_t Size) {
+  assert(Size == 1, "Invalid input length");
+
+  uint8_t Reset;
+  readUInt8(Data, Reset);
+
+  TickStats Stats = statsCollectTicks();
+  if (Reset)
+    statsResetTicks();
+
+#if defined(EZ_CLANG_RAMFUNC_HOTPATH) && defined(__arm__)
+  constexpr bool HotPathInRAM = true;
+#else
+  constexpr bool HotPathInRAM = false;
+#endif
+
+  char *Resp = responseAcquire(1 + 1 + 5 * 8);
+  Resp += writeBool(Resp, false); // HasError
+  Resp += writeBool(Resp, HotPathInRAM);
+  Resp += writeUInt64(Resp, device_getCycleCounterFrequency());
+  Resp += writeUInt64(Resp, Stats.Ticks);
+  Resp += writeUInt64(Resp, Stats.MinCycles);
+  Resp += writeUInt64(Resp, Stats.MaxCycles);
+  Resp += writeUInt64(Resp, Stats.MeanCycles);
+  return responseFinalize(Resp);
+}
+
+// Read a block of memory of any size. Input: address, size. Output: HasError,
+// size-prefixed bytes (in multiple parts if necessary).
+char *__ez_clang_rpc_mem_read(const char *Data, size_t Size) {
+  assert(Size == 16, "Invalid input length");
+
+  uint32_t Addr;
+  uint32_t Bytes;
+  Data += readAddr(Data, Addr);
+  Data += readSize(Data, Bytes);
+
+  char *Resp = responseAcquire(1 + 8);
   Resp += writeBool(Resp, false); // HasError
+  Resp += writeUInt64(Resp, Bytes);
+  Resp = responseWriteBytes(Resp, addr2ptr(Addr), Bytes);
   return responseFinalize(Resp);
 }
 
@@ -121,9 +416,17 @@ void __ez_clang_report_string(const char *Data, size_t Size) {
   sendMessage(ReportString, NoSequenceNumber, Data, Size);
 }
 
+uint32_t __ez_clang_crc32(uint32_t Crc, const char *Data, size_t Size) {
+  return crc32(Crc, Data, Size);
+}
+
 char *__ez_clang_inline_heap_acquire(size_t Bytes) {
+  if (InlineHeapPtr == nullptr || InlineHeapPtr > InlineHeapEnd ||
+      Bytes > static_cast<size_t>(InlineHeapEnd - InlineHeapPtr))
+    return nullptr;
   char *Block = const_cast<char *>(InlineHeapPtr);
   InlineHeapPtr = align_ptr<32>(InlineHeapPtr + Bytes);
+  statsTrackMessageBuffer(InlineHeapPtr);
   return Block;
 }
 
@@ -2,6 +2,8 @@
 
 #include "ez/response.h"
 
+#include <cstring>
+
 jmp_buf GlobalAssertionFailureReturnPoint;
 char *GlobalAssertionFailureBuffer;
 uint32_t GlobalAssertionFailureBufferSize;
@@ -11,7 +13,7 @@ uint32_t GlobalAssertionFailureBufferSize;
 // We will send back a hangup message and pass this in the payload
 EZ_NORETURN void fail(const char *Description) {
   errorEx(GlobalAssertionFailureBuffer, GlobalAssertionFailureBufferSize,
-          "Assertion failed: %s", Description);
+          ErrAssertionFailed, Description, strlen(Description));
   longjmp(GlobalAssertionFailureReturnPoint, 1); // TODO: Allow custom error codes
   EZ_BUILTIN_UNREACHABLE;
 }
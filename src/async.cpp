@@ -0,0 +1,216 @@
+#include "ez/async.h"
+
+#include "ez/abi.h"
+#include "ez/assert.h"
+#include "ez/device.h"
+#include "ez/response.h"
+#include "ez/serialize.h"
+#include "ez/stream.h"
+#include "ez/support.h"
+
+#include <cstdint>
+
+//
+// Asynchronous execute: The function runs as a cooperative context on its own
+// stack. The host provides a region from the code buffer for it: the top
+// AsyncStackSize bytes are the stack and the inline-heap takes the rest. The
+// message loop resumes the function whenever it's idle and the function must
+// call __ez_clang_yield() periodically, so the loop can serve requests like
+// memory reads, status polls and cancellation in between.
+//
+// Cancelling a function means we never resume it. There is no unwinding, so
+// it shouldn't hold resources beyond its region.
+//
+
+enum AsyncState : uint32_t {
+  AsyncIdle,
+  AsyncRunning,
+  AsyncFinished,
+  AsyncCancelled,
+  AsyncFaulted
+};
+
+struct AsyncJob {
+  AsyncState State;
+  uint32_t FnAddr;
+  uint32_t StackPtr; // Saved while suspended
+  const char *InlineHeapPtr;
+  const char *InlineHeapEnd;
+  uint32_t Resumes;
+};
+
+static AsyncJob Job{AsyncIdle, 0, 0, nullptr, nullptr, 0};
+
+// Fixed stack size at the top of the region. Inline-heap allocations fail
+// before they reach it.
+constexpr uint32_t AsyncStackSize = 512;
+static bool InJob = false;
+
+extern const char *InlineHeapPtr;
+extern const char *InlineHeapEnd;
+
+#if defined(__arm__) && defined(__thumb__)
+
+static uint32_t MainStackPtr = 0;
+
+extern "C" void __ez_clang_context_switch(uint32_t *SaveSP, uint32_t LoadSP);
+
+// Save callee-saved registers on the current stack, switch stacks and restore
+// them from the other one. Thumb-1 only, so it runs on Cortex-M0+ as well.
+extern "C" __attribute__((naked)) void
+__ez_clang_context_switch(uint32_t *SaveSP, uint32_t LoadSP) {
+  asm volatile("push {r4-r7, lr}\n"
+               "mov r4, r8\n"
+               "mov r5, r9\n"
+               "mov r6, r10\n"
+               "mov r7, r11\n"
+               "push {r4-r7}\n"
+               "mov r2, sp\n"
+               "str r2, [r0]\n"
+               "mov sp, r1\n"
+               "pop {r4-r7}\n"
+               "mov r8, r4\n"
+               "mov r9, r5\n"
+               "mov r10, r6\n"
+               "mov r11, r7\n"
+               "pop {r4-r7, pc}\n");
+}
+
+// Number of words that __ez_clang_context_switch pops: r8-r11, r4-r7, pc
+constexpr uint32_t InitialFrameWords = 9;
+
+static void switchToJob() {
+  InlineHeapPtr = Job.InlineHeapPtr;
+  InlineHeapEnd = Job.InlineHeapEnd;
+  InJob = true;
+  Job.Resumes += 1;
+  __ez_clang_context_switch(&MainStackPtr, Job.StackPtr);
+  InJob = false;
+  Job.InlineHeapPtr = InlineHeapPtr;
+  Job.InlineHeapEnd = InlineHeapEnd;
+  InlineHeapPtr = nullptr;
+  InlineHeapEnd = nullptr;
+}
+
+static void switchToMain() {
+  __ez_clang_context_switch(&Job.StackPtr, MainStackPtr);
+}
+
+// Bottom of each job's stack. It's never resumed after it finished.
+static void jobEntry() {
+  typedef void ClingFn_t(void *);
+  ClingFn_t *Fn = (ClingFn_t *)((uintptr_t)Job.FnAddr);
+  uint64_t Unused = 0;
+  Fn((void *)&Unused);
+  Job.State = AsyncFinished;
+  switchToMain();
+  EZ_BUILTIN_UNREACHABLE;
+}
+
+static void setupJobStack(char *Region, uint32_t Size) {
+  uint32_t *Top = reinterpret_cast<uint32_t *>(
+      addr2ptr(ptr2addr(Region + Size) & ~0x7u));
+  uint32_t *Frame = Top - InitialFrameWords;
+  for (uint32_t i = 0; i < InitialFrameWords - 1; i += 1)
+    Frame[i] = 0;
+  Frame[InitialFrameWords - 1] = ptr2addr(&jobEntry) | 1;
+  Job.StackPtr = ptr2addr(Frame);
+}
+
+void asyncRunUntilInput() {
+  if (Job.State == AsyncRunning && !device_receiveReady())
+    switchToJob();
+}
+
+#else
+
+// No context switching on this target
+static void setupJobStack(char *, uint32_t) {}
+static void switchToMain() {}
+void asyncRunUntilInput() {}
+
+#endif
+
+bool asyncFault() {
+  // The fault unwound the job's stack and we never resume it
+  if (!InJob)
+    return false;
+  InJob = false;
+  Job.State = AsyncFaulted;
+  Job.InlineHeapPtr = nullptr;
+  Job.InlineHeapEnd = nullptr;
+  return true;
+}
+
+void asyncReset() {
+  Job = AsyncJob{AsyncIdle, 0, 0, nullptr, nullptr, 0};
+  InJob = false;
+}
+
+extern "C" {
+
+// Hand control back to the message loop if there is a request waiting. Send
+// full chunks of the telemetry stream in any case.
+void __ez_clang_yield() {
+  streamDrain(false);
+  if (InJob && device_receiveReady())
+    switchToMain();
+}
+
+// Start a function asynchronously. Input: function address, region address,
+// region size. Output: HasError.
+char *__ez_clang_rpc_execute_async(const char *Data, size_t Size) {
+  assert(Size == 24, "Invalid input length");
+
+  uint32_t FnAddr;
+  uint32_t RegionAddr;
+  uint32_t RegionSize;
+  Data += readAddr(Data, FnAddr);
+  Data += readAddr(Data, RegionAddr);
+  Data += readSize(Data, RegionSize);
+
+  if (!isThumbFunction(FnAddr))
+    return error(ErrNonThumbFunction, FnAddr);
+  if (Job.State == AsyncRunning)
+    return error(ErrAsyncBusy, Job.FnAddr);
+  constexpr uint32_t MinRegionSize = AsyncStackSize + 64;
+  if (RegionSize < MinRegionSize)
+    return error(ErrAsyncRegionTooSmall, RegionSize, MinRegionSize);
+#if !defined(__arm__) || !defined(__thumb__)
+  return error(ErrAsyncUnsupported);
+#endif
+
+  char *Region = addr2ptr(RegionAddr);
+  Job = AsyncJob{AsyncRunning, FnAddr, 0, align_ptr<32>(Region),
+                 Region + RegionSize - AsyncStackSize, 0};
+  setupJobStack(Region, RegionSize);
+
+  char *Resp = responseAcquire(1);
+  Resp += writeBool(Resp, false); // HasError
+  return responseFinalize(Resp);
+}
+
+// Output: HasError, state (0 idle, 1 running, 2 finished, 3 cancelled,
+// 4 faulted), number of times the function was resumed
+char *__ez_clang_rpc_execute_status(const char *Data, size_t Size) {
+  assert(Size == 0, "Invalid input length");
+  char *Resp = responseAcquire(1 + 8 + 8);
+  Resp += writeBool(Resp, false); // HasError
+  Resp += writeUInt64(Resp, Job.State);
+  Resp += writeUInt64(Resp, Job.Resumes);
+  return responseFinalize(Resp);
+}
+
+// Stop resuming the running function. Output: HasError, previous state.
+char *__ez_clang_rpc_execute_cancel(const char *Data, size_t Size) {
+  assert(Size == 0, "Invalid input length");
+  AsyncState Previous = Job.State;
+  if (Job.State == AsyncRunning)
+    Job.State = AsyncCancelled;
+  char *Resp = responseAcquire(1 + 8);
+  Resp += writeBool(Resp, false); // HasError
+  Resp += writeUInt64(Resp, Previous);
+  return responseFinalize(Resp);
+}
+
+} // extern "C"
@@ -0,0 +1,22 @@
+#include "ez/crc.h"
+
+#include "ez/support.h"
+
+// Nibble-wise lookup keeps the table small (64 bytes in flash)
+static const uint32_t Crc32Nibbles[16] = {
+  0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+  0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+  0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+  0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+EZ_CLANG_RAMFUNC
+uint32_t crc32(uint32_t Crc, const char *Data, size_t Size) {
+  Crc = ~Crc;
+  for (size_t i = 0; i < Size; i += 1) {
+    Crc ^= static_cast<uint8_t>(Data[i]);
+    Crc = (Crc >> 4) ^ Crc32Nibbles[Crc & 0x0F];
+    Crc = (Crc >> 4) ^ Crc32Nibbles[Crc & 0x0F];
+  }
+  return ~Crc;
+}
@@ -1,21 +1,28 @@
 #include "ez/assert.h"
+#include "ez/async.h"
 #include "ez/device.h"
+#include "ez/fault.h"
+#include "ez/irq.h"
 #include "ez/response.h"
+#include "ez/schedule.h"
 #include "ez/protocol.h"
 #include "ez/serialize.h"
+#include "ez/stats.h"
+#include "ez/stream.h"
 #include "ez/support.h"
 #include "ez/symbols.h"
+#include "ez/trampoline.h"
 
 #include <csetjmp>
 #include <cstddef>
 #include <cstdint>
 
-#define EZ_CLANG_PROTOCOL_VERSION_STR "0.0.5"
+#define EZ_CLANG_PROTOCOL_VERSION_STR "0.0.10"
 
 //
 // Static buffer for RPC requests and responses
 //
-char MessageBuffer[0x400] __attribute__((aligned(0x100)));
+char MessageBuffer[MessageBufferSize] __attribute__((aligned(0x100)));
 
 //
 // Boundaries of the code buffer are provided from linker script
@@ -23,21 +30,48 @@ char MessageBuffer[0x400] __attribute__((aligned(0x100)));
 extern char _scode_buffer;
 extern char _ecode_buffer;
 
+//
+// Request that is currently processed, so we can answer it after a fault
+//
+static bool RequestInFlight = false;
+static uint32_t RequestSeqID = 0;
+
+extern const char *InlineHeapPtr;
+extern const char *InlineHeapEnd;
+
 void ez_clang_setup() {
+  asyncReset();
+  scheduleReset();
+  irqReset();
+  trampolineReset();
+  streamReset();
+  faultReset();
+  RequestInFlight = false;
   device_setupSendReceive();
+  faultSaveInterruptMasks();
+  device_setupCycleCounter();
 
   SetupInfo Info;
   Info.Version = EZ_CLANG_PROTOCOL_VERSION_STR;
   Info.CodeBuffer = &_scode_buffer;
   Info.CodeBufferSize = &_ecode_buffer - &_scode_buffer;
   Info.NumSymbols = getBootstrapSymbols(&Info.Symbols);
+  Info.NumRegions = device_getMemoryRegions(&Info.Regions);
   sendSetupMessage(MessageBuffer, Info);
 }
 
+EZ_CLANG_RAMFUNC
 bool ez_clang_tick(uint8_t &ErrCode) {
   // Reserve the entire MessageBuffer for input.
   responseClearBuffer();
 
+  // Let an asynchronous function run and drain the telemetry stream while we
+  // wait for the next message
+  do {
+    asyncRunUntilInput();
+    streamDrain(false);
+  } while (streamIsActive() && !device_receiveReady());
+
   // Explicit errors during message processing can be recoverable. We send
   // back an error response and wait for the next message.
   HeaderInfo Msg;
@@ -54,17 +88,48 @@ bool ez_clang_tick(uint8_t &ErrCode) {
     return false;
   }
 
-  // Define the ResponseBuffer in direct succession to the input message.
+  // Define the ResponseBuffer in direct succession to the input message. Keep
+  // room for the message header in front, so the Result goes out in one piece.
   char *InputEnd = MessageBuffer + Msg.PayloadBytes;
   size_t RemainingCapacity = c_array_size(MessageBuffer) - Msg.PayloadBytes;
-  const char *RespBegin = responseSetBuffer(InputEnd, RemainingCapacity);
+  responseSetBuffer(InputEnd, RemainingCapacity, MessageHeaderSize,
+                    MessageBuffer);
+  responseSetSeqID(Msg.SeqID);
 
   // Invoke the handler for the requested endpoint. Handlers can use the error()
   // function to write error responses.
+  RequestInFlight = true;
+  RequestSeqID = Msg.SeqID;
   const char *RespEnd = Msg.Handler(MessageBuffer, Msg.PayloadBytes);
+  RequestInFlight = false;
+
+  statsTrackMessageBuffer(RespEnd);
+  // Time spent waiting for the link doesn't count
+  uint32_t TickCycles = device_readCycleCounter() - Msg.FrameBegin;
+  statsTrackTick(TickCycles - Msg.ReceiveCycles);
+
+  // Send the response back to the host and finish this tick. Error responses
+  // may have moved the response buffer.
+  const char *RespBegin = responseGetBuffer();
+  char *Frame = const_cast<char *>(RespBegin) - MessageHeaderSize;
+  sendMessageInPlace(Result, Msg.SeqID, Frame, RespEnd - RespBegin);
+  return true;
+}
 
-  // Send the response back to the host and finish this tick.
-  sendMessage(Result, Msg.SeqID, RespBegin, RespEnd - RespBegin);
+// After a fault in JIT code, answer the pending request with the fault record.
+// Returns false if nobody is waiting for it and the session should end.
+static bool recoverFromFault() {
+  InlineHeapPtr = nullptr;
+  InlineHeapEnd = nullptr;
+  if (asyncFault())
+    return true;
+  if (!RequestInFlight)
+    return false;
+
+  RequestInFlight = false;
+  uint32_t Size;
+  const char *ErrResp = errorGetBuffer(Size);
+  sendMessage(Result, RequestSeqID, ErrResp, Size);
   return true;
 }
 
@@ -72,6 +137,7 @@ bool ez_clang_tick(uint8_t &ErrCode) {
 // Arduino initialization function
 //
 extern "C" void setup() {
+  statsPaintStack();
   device_notifyBoot();
 }
 
@@ -86,10 +152,16 @@ extern "C" void loop() {
   int EC = setjmp(GlobalAssertionFailureReturnPoint);
   uint8_t ErrCode = EC; // EC >= 0 && EC <= 0x7f
 
+  // A fault in JIT code unwinds here as well. If we can report it, the session
+  // continues with the code buffer intact.
+  bool Recovered = ErrCode == FaultErrCode && recoverFromFault();
+
   // If we didn't get here by longjmp, then this is a restart
-  if (ErrCode == 0) {
-    device_notifyReady();
-    ez_clang_setup();
+  if (ErrCode == 0 || Recovered) {
+    if (!Recovered) {
+      device_notifyReady();
+      ez_clang_setup();
+    }
     while (ez_clang_tick(ErrCode))
       device_notifyTick();
   }
@@ -0,0 +1,196 @@
+#ifdef EZ_CLANG_DSP_BENCH
+
+#include "ez/abi.h"
+
+#include "ez/assert.h"
+#include "ez/crc.h"
+#include "ez/device.h"
+#include "ez/response.h"
+#include "ez/serialize.h"
+#include "ez/support.h"
+
+#include <cstdint>
+
+// CMSIS-DSP version 4 needs to know the core
+#if !defined(ARM_MATH_CM3) && !defined(ARM_MATH_CM0PLUS)
+#if defined(__ARM_ARCH_7M__)
+#define ARM_MATH_CM3
+#else
+#define ARM_MATH_CM0PLUS
+#endif
+#endif
+
+#include "arm_math.h"
+
+//
+// DSP benchmark: Compare the fixed-point kernels from CMSIS-DSP, which the
+// firmware keeps resident, with naive loops JIT'd from the host. Both kinds
+// run on the same fixtures, so the output checksums must match. Naive kernels
+// have the same signature as functions for __ez_clang_rpc_execute and access
+// the exported fixture buffers directly:
+//
+//   FIR:    signal (256) * coeffs (32) -> output (256), zero history
+//   Matrix: mat_a (16x16) * mat_b (16x16) -> mat_c (16x16), Q15 saturated
+//   FFT:    fft (256 complex values, in-place), scaled like arm_cfft_q15
+//
+// Teensy LC ships an older CMSIS-DSP without arm_cfft_q15 and we couldn't fit
+// the radix-4 twiddle tables anyway. We skip the FFT there.
+//
+
+#if !defined(CORE_TEENSY)
+#define EZ_CLANG_DSP_BENCH_FFT
+#endif
+
+constexpr uint32_t SignalLen = 256;
+constexpr uint32_t FirTaps = 32;
+constexpr uint32_t MatDim = 16;
+constexpr uint32_t FftLen = 256;
+
+extern "C" {
+int16_t __ez_clang_dsp_bench_signal[SignalLen];
+int16_t __ez_clang_dsp_bench_coeffs[FirTaps];
+int16_t __ez_clang_dsp_bench_output[SignalLen];
+int16_t __ez_clang_dsp_bench_mat_a[MatDim * MatDim];
+int16_t __ez_clang_dsp_bench_mat_b[MatDim * MatDim];
+int16_t __ez_clang_dsp_bench_mat_c[MatDim * MatDim];
+int16_t __ez_clang_dsp_bench_fft[2 * FftLen];
+}
+
+static q15_t FirState[FirTaps + SignalLen];
+static q15_t MatScratch[MatDim * MatDim];
+static arm_fir_instance_q15 Fir;
+
+// Deterministic pseudo-random Q15 values (same sequence on every board)
+static void fillFixture(int16_t *Buffer, uint32_t Count, uint32_t &Seed) {
+  for (uint32_t i = 0; i < Count; i += 1) {
+    Seed = Seed * 1664525u + 1013904223u;
+    Buffer[i] = static_cast<int16_t>(Seed >> 16) / 8;
+  }
+}
+
+// Restore inputs before each run, since the FFT works in-place
+static void resetFixtures() {
+  uint32_t Seed = 0x455A;
+  fillFixture(__ez_clang_dsp_bench_signal, SignalLen, Seed);
+  fillFixture(__ez_clang_dsp_bench_coeffs, FirTaps, Seed);
+  fillFixture(__ez_clang_dsp_bench_mat_a, MatDim * MatDim, Seed);
+  fillFixture(__ez_clang_dsp_bench_mat_b, MatDim * MatDim, Seed);
+  fillFixture(__ez_clang_dsp_bench_fft, 2 * FftLen, Seed);
+  for (int16_t &Value : __ez_clang_dsp_bench_output)
+    Value = 0;
+  for (int16_t &Value : __ez_clang_dsp_bench_mat_c)
+    Value = 0;
+  arm_fir_init_q15(&Fir, FirTaps, __ez_clang_dsp_bench_coeffs, FirState,
+                   SignalLen);
+}
+
+static void cmsisFir(void *) {
+  arm_fir_q15(&Fir, __ez_clang_dsp_bench_signal, __ez_clang_dsp_bench_output,
+              SignalLen);
+}
+
+static void cmsisMatMult(void *) {
+  arm_matrix_instance_q15 A{MatDim, MatDim, __ez_clang_dsp_bench_mat_a};
+  arm_matrix_instance_q15 B{MatDim, MatDim, __ez_clang_dsp_bench_mat_b};
+  arm_matrix_instance_q15 C{MatDim, MatDim, __ez_clang_dsp_bench_mat_c};
+  arm_mat_mult_q15(&A, &B, &C, MatScratch);
+}
+
+#ifdef EZ_CLANG_DSP_BENCH_FFT
+static void cmsisCfft(void *) {
+  arm_cfft_q15(&arm_cfft_sR_q15_len256, __ez_clang_dsp_bench_fft, 0, 1);
+}
+#endif
+
+typedef void KernelFn_t(void *);
+
+struct DspKernel {
+  KernelFn_t *Cmsis;
+  const int16_t *Output;
+  uint32_t OutputSize;
+};
+
+static const DspKernel Kernels[] {
+  { &cmsisFir, __ez_clang_dsp_bench_output,
+    sizeof(__ez_clang_dsp_bench_output) },
+  { &cmsisMatMult, __ez_clang_dsp_bench_mat_c,
+    sizeof(__ez_clang_dsp_bench_mat_c) },
+#ifdef EZ_CLANG_DSP_BENCH_FFT
+  { &cmsisCfft, __ez_clang_dsp_bench_fft, sizeof(__ez_clang_dsp_bench_fft) },
+#else
+  { nullptr, __ez_clang_dsp_bench_fft, sizeof(__ez_clang_dsp_bench_fft) },
+#endif
+};
+
+// Run the kernel on fresh fixtures and keep the fastest run. Returns the
+// duration in milliseconds of a run that exceeded the range of the cycle
+// counter, or 0 on success.
+static uint32_t measureKernel(KernelFn_t *Fn, uint32_t Iterations,
+                              uint32_t &Best) {
+  uint32_t RangeMillis = device_getCycleCounterRangeMillis();
+  uint64_t Unused = 0;
+  Best = UINT32_MAX;
+  for (uint32_t i = 0; i < Iterations; i += 1) {
+    resetFixtures();
+    uint32_t BeginMillis = device_readMillis();
+    uint32_t Begin = device_readCycleCounter();
+    Fn((void *)&Unused);
+    uint32_t End = device_readCycleCounter();
+    uint32_t Millis = device_readMillis() - BeginMillis;
+    if (Millis >= RangeMillis)
+      return Millis;
+    if (End - Begin < Best)
+      Best = End - Begin;
+  }
+  return 0;
+}
+
+extern "C" {
+
+// Input: iterations, one naive function address per kernel (0 to skip)
+// Output: HasError, number of kernels, for each: CMSIS cycles, CMSIS output
+// CRC-32, naive cycles, naive output CRC-32 (all 0 if skipped)
+char *__ez_clang_rpc_dsp_bench(const char *Data, size_t Size) {
+  constexpr uint32_t NumKernels = c_array_size(Kernels);
+  assert(Size == 8 + NumKernels * 8, "Invalid input length");
+
+  uint32_t Iterations;
+  Data += readSize(Data, Iterations);
+  uint32_t NaiveAddrs[NumKernels];
+  for (uint32_t i = 0; i < NumKernels; i += 1) {
+    Data += readAddr(Data, NaiveAddrs[i]);
+    if (NaiveAddrs[i] != 0 && !isThumbFunction(NaiveAddrs[i]))
+      return error(ErrNonThumbFunction, NaiveAddrs[i]);
+  }
+  if (Iterations == 0)
+    return error(ErrBenchmarkNoIterations);
+
+  char *Resp = responseAcquire(1 + 8 + NumKernels * 4 * 8);
+  Resp += writeBool(Resp, false); // HasError
+  Resp += writeUInt64(Resp, NumKernels);
+
+  for (uint32_t i = 0; i < NumKernels; i += 1) {
+    const DspKernel &K = Kernels[i];
+    const char *Output = reinterpret_cast<const char *>(K.Output);
+    KernelFn_t *Variants[2] = {K.Cmsis,
+                               (KernelFn_t *)addr2ptr(NaiveAddrs[i])};
+    for (KernelFn_t *Fn : Variants) {
+      uint32_t Cycles = 0;
+      uint32_t Crc = 0;
+      if (Fn) {
+        if (uint32_t Millis = measureKernel(Fn, Iterations, Cycles))
+          return error(ErrCycleCounterRange, Millis,
+                       device_getCycleCounterRangeMillis());
+        Crc = crc32(0, Output, K.OutputSize);
+      }
+      Resp += writeUInt64(Resp, Cycles);
+      Resp += writeUInt64(Resp, Crc);
+    }
+  }
+
+  return responseFinalize(Resp);
+}
+
+} // extern "C"
+
+#endif // EZ_CLANG_DSP_BENCH
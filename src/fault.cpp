@@ -0,0 +1,181 @@
+#include "ez/fault.h"
+
+#include "ez/abi.h"
+
+#include "ez/assert.h"
+#include "ez/response.h"
+#include "ez/serialize.h"
+#include "ez/support.h"
+
+#include <csetjmp>
+#include <cstdint>
+
+//
+// Fault recovery: A HardFault in JIT code (e.g. a bad pointer or an undefined
+// instruction) doesn't reboot the device. The handler captures the registers
+// that the core stacked on exception entry and returns from the exception into
+// faultRecover() instead of the faulting instruction. From there we longjmp
+// back into the message loop like a failed assertion. The message loop reports
+// the fault as the result of the pending request (or marks the asynchronous
+// function as faulted) and the session continues with the code buffer intact.
+//
+// Faults in handler mode, i.e. in interrupt handlers and scheduled functions,
+// can't be unwound this way. We reset the device instead.
+//
+
+// Registers in the exception frame (same order as the core stacks them)
+struct FaultFrame {
+  uint32_t R0, R1, R2, R3, R12, LR, PC, XPSR;
+};
+
+static_assert(sizeof(FaultFrame) == 32, "Exception frame layout mismatch");
+
+static FaultFrame LastFrame{0, 0, 0, 0, 0, 0, 0, 0};
+static uint32_t LastCFSR = 0;
+static uint32_t LastHFSR = 0;
+static uint32_t LastAddr = 0;
+static uint32_t NumFaults = 0;
+
+void faultReset() {
+  LastFrame = FaultFrame{0, 0, 0, 0, 0, 0, 0, 0};
+  LastCFSR = 0;
+  LastHFSR = 0;
+  LastAddr = 0;
+  NumFaults = 0;
+}
+
+#if defined(__arm__) && defined(__thumb__)
+
+// System control block registers. Only ARMv7-M has fault status registers.
+static volatile uint32_t &AIRCR = *reinterpret_cast<uint32_t *>(0xE000ED0C);
+#if defined(__ARM_ARCH_7M__)
+static volatile uint32_t &CFSR = *reinterpret_cast<uint32_t *>(0xE000ED28);
+static volatile uint32_t &HFSR = *reinterpret_cast<uint32_t *>(0xE000ED2C);
+static volatile uint32_t &MMFAR = *reinterpret_cast<uint32_t *>(0xE000ED34);
+static volatile uint32_t &BFAR = *reinterpret_cast<uint32_t *>(0xE000ED38);
+constexpr uint32_t CFSR_MMARVALID = 1u << 7;
+constexpr uint32_t CFSR_BFARVALID = 1u << 15;
+#endif
+
+constexpr uint32_t ExcReturnThreadMode = 1u << 3;
+constexpr uint32_t XPSRStackAlign = 1u << 9;
+constexpr uint32_t XPSRThumb = 1u << 24;
+
+// Interrupt masks of the session, e.g. Teensy LC runs with PRIMASK set
+static uint32_t SessionPrimask = 0;
+#if defined(__ARM_ARCH_7M__)
+static uint32_t SessionBasepri = 0;
+#endif
+
+void faultSaveInterruptMasks() {
+  asm volatile("mrs %0, primask\n" : "=r"(SessionPrimask));
+#if defined(__ARM_ARCH_7M__)
+  asm volatile("mrs %0, basepri\n" : "=r"(SessionBasepri));
+#endif
+}
+
+// Set while we return into faultRecover(). Another fault on the way means that
+// the firmware itself is broken.
+static volatile bool Recovering = false;
+
+EZ_NORETURN static void faultResetSystem() {
+  asm volatile("dsb\n");
+  AIRCR = 0x05FA0004; // VECTKEY | SYSRESETREQ
+  asm volatile("dsb\n");
+  while (true) {}
+}
+
+// Runs in thread mode on the stack of the faulting code
+static void faultRecover() {
+  // The faulting code might have changed the interrupt masks. Restore the
+  // ones that the transport of the session expects.
+#if defined(__ARM_ARCH_7M__)
+  asm volatile("msr basepri, %0\n" : : "r"(SessionBasepri) : "memory");
+#endif
+  asm volatile("msr primask, %0\n" : : "r"(SessionPrimask) : "memory");
+
+  const char *Detail = reinterpret_cast<const char *>(&LastFrame);
+  errorEx(GlobalAssertionFailureBuffer, GlobalAssertionFailureBufferSize,
+          ErrFault, Detail, sizeof(LastFrame), LastFrame.PC, LastFrame.LR,
+          LastCFSR, LastAddr);
+  Recovering = false;
+  longjmp(GlobalAssertionFailureReturnPoint, FaultErrCode);
+}
+
+extern "C" void __ez_clang_fault_handler(uint32_t *Frame, uint32_t ExcReturn) {
+  if (!(ExcReturn & ExcReturnThreadMode) || Recovering)
+    faultResetSystem();
+
+  Recovering = true;
+  NumFaults += 1;
+  LastFrame = *reinterpret_cast<FaultFrame *>(Frame);
+
+#if defined(__ARM_ARCH_7M__)
+  LastCFSR = CFSR;
+  LastHFSR = HFSR;
+  if (LastCFSR & CFSR_MMARVALID)
+    LastAddr = MMFAR;
+  else if (LastCFSR & CFSR_BFARVALID)
+    LastAddr = BFAR;
+  else
+    LastAddr = 0;
+  CFSR = LastCFSR; // Write-one-to-clear
+  HFSR = LastHFSR;
+#endif
+
+  // Exception return continues in faultRecover(). Drop IT/ICI state from the
+  // faulting instruction.
+  FaultFrame *Ret = reinterpret_cast<FaultFrame *>(Frame);
+  Ret->PC = ptr2addr((void *)&faultRecover) & ~0x1u;
+  Ret->XPSR = (Ret->XPSR & XPSRStackAlign) | XPSRThumb;
+}
+
+// Pass the exception frame and EXC_RETURN to the handler. Thumb-1 only, so it
+// runs on Cortex-M0+ as well.
+extern "C" __attribute__((naked)) void __ez_clang_fault_entry() {
+  asm volatile("movs r0, #4\n"
+               "mov r1, lr\n"
+               "tst r0, r1\n"
+               "beq 1f\n"
+               "mrs r0, psp\n"
+               "b 2f\n"
+               "1:\n"
+               "mrs r0, msp\n"
+               "2:\n"
+               "push {r4, lr}\n"
+               "bl __ez_clang_fault_handler\n"
+               "pop {r4, pc}\n");
+}
+
+#else
+
+// No fault handlers on this target
+extern "C" void __ez_clang_fault_entry() {}
+void faultSaveInterruptMasks() {}
+
+#endif
+
+extern "C" {
+
+// Output: HasError, number of faults in this session and the last fault:
+// r0, r1, r2, r3, r12, lr, pc, xpsr, CFSR, HFSR, fault address
+char *__ez_clang_rpc_fault_info(const char *Data, size_t Size) {
+  assert(Size == 0, "Invalid input length");
+  char *Resp = responseAcquire(1 + 12 * 8);
+  Resp += writeBool(Resp, false); // HasError
+  Resp += writeUInt64(Resp, NumFaults);
+  Resp += writeUInt64(Resp, LastFrame.R0);
+  Resp += writeUInt64(Resp, LastFrame.R1);
+  Resp += writeUInt64(Resp, LastFrame.R2);
+  Resp += writeUInt64(Resp, LastFrame.R3);
+  Resp += writeUInt64(Resp, LastFrame.R12);
+  Resp += writeUInt64(Resp, LastFrame.LR);
+  Resp += writeUInt64(Resp, LastFrame.PC);
+  Resp += writeUInt64(Resp, LastFrame.XPSR);
+  Resp += writeUInt64(Resp, LastCFSR);
+  Resp += writeUInt64(Resp, LastHFSR);
+  Resp += writeUInt64(Resp, LastAddr);
+  return responseFinalize(Resp);
+}
+
+} // extern "C"
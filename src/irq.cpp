@@ -0,0 +1,111 @@
+#include "ez/irq.h"
+
+#include "ez/abi.h"
+
+#include "ez/assert.h"
+#include "ez/device.h"
+#include "ez/response.h"
+#include "ez/serialize.h"
+#include "ez/support.h"
+
+#include <cstdint>
+
+//
+// Interrupt handlers from JIT code. Handlers are committed functions without
+// arguments. They run in interrupt context with the same restrictions as
+// scheduled functions: keep them short and use __ez_clang_stream_write()
+// instead of reports. JIT code must configure the peripheral itself to raise
+// the interrupt.
+//
+// Handlers live in the code buffer, so they must all be detached before the
+// next session overwrites it.
+//
+
+constexpr uint32_t MaxInterrupts = 64;
+static uint32_t Attached[MaxInterrupts / 32] = {0, 0};
+
+static bool isAttached(uint32_t Irq) {
+  return Attached[Irq / 32] & (1u << (Irq % 32));
+}
+
+static void setAttached(uint32_t Irq, bool Value) {
+  if (Value)
+    Attached[Irq / 32] |= 1u << (Irq % 32);
+  else
+    Attached[Irq / 32] &= ~(1u << (Irq % 32));
+}
+
+void irqReset() {
+  for (uint32_t Irq = 0; Irq < MaxInterrupts; Irq += 1) {
+    if (isAttached(Irq)) {
+      device_detachInterrupt(Irq);
+      setAttached(Irq, false);
+    }
+  }
+}
+
+static char *checkInterrupt(uint32_t Irq) {
+  uint32_t NumInterrupts = device_getNumInterrupts();
+  if (NumInterrupts == 0)
+    return error(ErrIrqUnsupported);
+  if (Irq >= NumInterrupts || Irq >= MaxInterrupts)
+    return error(ErrIrqOutOfRange, Irq, NumInterrupts);
+  if (device_isReservedInterrupt(Irq))
+    return error(ErrIrqReserved, Irq);
+  return nullptr;
+}
+
+extern "C" {
+
+// Install a committed function as handler for a peripheral interrupt and
+// enable it. Replaces a previous handler. Input: interrupt number, function
+// address, priority (0 is highest). Output: HasError.
+char *__ez_clang_rpc_irq_attach(const char *Data, size_t Size) {
+  assert(Size == 24, "Invalid input length");
+
+  uint32_t Irq;
+  uint32_t FnAddr;
+  uint32_t Priority;
+  Data += readSize(Data, Irq);
+  Data += readAddr(Data, FnAddr);
+  Data += readSize(Data, Priority);
+
+  if (char *Err = checkInterrupt(Irq))
+    return Err;
+  if (!isThumbFunction(FnAddr))
+    return error(ErrNonThumbFunction, FnAddr);
+  uint32_t NumPriorities = device_getNumInterruptPriorities();
+  if (Priority >= NumPriorities)
+    return error(ErrIrqPriority, Priority, NumPriorities);
+
+  typedef void HandlerFn();
+  device_attachInterrupt(Irq, Priority, (HandlerFn *)((uintptr_t)FnAddr));
+  setAttached(Irq, true);
+
+  char *Resp = responseAcquire(1);
+  Resp += writeBool(Resp, false); // HasError
+  return responseFinalize(Resp);
+}
+
+// Disable a peripheral interrupt and restore the handler of the firmware.
+// Detaching an interrupt without handler is fine. Input: interrupt number.
+// Output: HasError.
+char *__ez_clang_rpc_irq_detach(const char *Data, size_t Size) {
+  assert(Size == 8, "Invalid input length");
+
+  uint32_t Irq;
+  readSize(Data, Irq);
+
+  if (char *Err = checkInterrupt(Irq))
+    return Err;
+  if (isAttached(Irq)) {
+    device_detachInterrupt(Irq);
+    setAttached(Irq, false);
+  }
+
+  char *Resp = responseAcquire(1);
+  Resp += writeBool(Resp, false); // HasError
+  return responseFinalize(Resp);
+}
+
+} // extern "C"
@@ -0,0 +1,81 @@
+#include "ez/jumptable.h"
+
+#include "ez/abi.h"
+
+#include "ez/assert.h"
+#include "ez/response.h"
+#include "ez/serialize.h"
+#include "ez/support.h"
+#include "ez/veneer.h"
+
+#include <csetjmp>
+#include <cstdint>
+
+//
+// ABI-stable exports: The relink step places a jump table at a fixed address
+// at the end of flash. Each exported function gets a slot, whose index is kept
+// in the board's slots.map across firmware rebuilds. Code that the host linked
+// against slot addresses remains valid as long as the slot map only grows.
+//
+// Slots are veneers (see ez/veneer.h) like trampolines, but the relink step
+// writes them to flash and they can't be retargeted.
+//
+// Slots of functions that were removed from the exports stay reserved and go
+// to the retired handler below.
+//
+
+// Slot index table (relink output): header, then one slot per symtab entry
+struct EzClang_SlotsHeader {
+  uint32_t NumSlots;
+  uint32_t MapHash[2];
+};
+
+extern const EzClang_SlotsHeader _sslots;
+extern const char _eslots;
+extern const char _sjumptable;
+
+static constexpr uint16_t NoSlot = 0xffff;
+static constexpr uint32_t SlotSize = VeneerSize;
+
+uint32_t jumptableLookup(uint32_t SymbolIndex, uint32_t Addr) {
+  // The relink step writes one entry per symtab entry. Anything else means
+  // that the firmware image is inconsistent.
+  const char *IndexBegin = reinterpret_cast<const char *>(&_sslots + 1);
+  if (&_eslots < IndexBegin ||
+      SymbolIndex >= (&_eslots - IndexBegin) / sizeof(uint16_t))
+    fail("Symbol has no entry in the jump table slot index");
+
+  const uint16_t *Slots = reinterpret_cast<const uint16_t *>(IndexBegin);
+  uint16_t Slot = Slots[SymbolIndex];
+  if (Slot == NoSlot || Slot >= _sslots.NumSlots)
+    return Addr;
+  return (ptr2addr(&_sjumptable) + Slot * SlotSize) | 1;
+}
+
+extern "C" {
+
+// Referenced by address from the jump table only. The relink step keeps it.
+void __ez_clang_jumptable_retired() {
+  // We are in the middle of executing JITed code and can't return to it
+  errorEx(GlobalAssertionFailureBuffer, GlobalAssertionFailureBufferSize,
+          ErrJumpTableRetired, nullptr, 0);
+  longjmp(GlobalAssertionFailureReturnPoint, 1);
+}
+
+// Output: HasError, table address, size of one slot, number of slots, 64-bit
+// hash of the slot map (little-endian, like all integers). The host can reuse
+// code that it linked against slot addresses as long as table address and slot
+// map hash match.
+char *__ez_clang_rpc_jumptable_info(const char *Data, size_t Size) {
+  assert(Size == 0, "Invalid input length");
+  char *Resp = responseAcquire(1 + 4 * 8);
+  Resp += writeBool(Resp, false); // HasError
+  Resp += writeUInt64(Resp, ptr2addr(&_sjumptable));
+  Resp += writeUInt64(Resp, SlotSize);
+  Resp += writeUInt64(Resp, _sslots.NumSlots);
+  Resp += writeUInt32(Resp, _sslots.MapHash[0]);
+  Resp += writeUInt32(Resp, _sslots.MapHash[1]);
+  return responseFinalize(Resp);
+}
+
+} // extern "C"
@@ -0,0 +1,68 @@
+#include "ez/abi.h"
+
+#include "ez/assert.h"
+#include "ez/response.h"
+#include "ez/support.h"
+#include "ez/symbols.h"
+
+#include <csetjmp>
+#include <cstring>
+
+//
+// Lazy binding: Instead of looking up all external symbols before commit, the
+// host can route calls through stubs in the code buffer. Each stub has a slot
+// and jumps to the slot's target. Initially that's the trampoline below, which
+// resolves the name from the device symbol table, patches the slot and
+// continues with the actual call. Later calls go straight to the target.
+//
+// Stub layout (16 bytes, 4-byte aligned, Thumb-1 so it runs on Cortex-M0+):
+//   0: b403      push {r0, r1}
+//   2: 4802      ldr  r0, [pc, #8]   ; &Slot
+//   4: 4684      mov  r12, r0
+//   6: 6800      ldr  r0, [r0]       ; Slot.Target
+//   8: 9001      str  r0, [sp, #4]
+//  10: bd01      pop  {r0, pc}
+//  12: .word     &Slot
+//
+// Argument registers r0-r3 and lr are preserved, r12 holds the slot address
+// (AAPCS allows veneers to clobber it). Only works for calls, data references
+// must be resolved eagerly.
+//
+
+extern "C" {
+
+uint32_t __ez_clang_lazy_resolve(EzClangLazySlot *Slot) {
+  const char *Name = addr2ptr(Slot->Name);
+  uint32_t Length = strlen(Name);
+  uint32_t Addr = lookupBuiltinSymbol(Name, Length);
+  if (!Addr)
+    Addr = lookupSymbol(Name, Length);
+
+  // We are in the middle of executing JITed code and can't return to it.
+  // Report the error with the Hangup message.
+  if (!Addr) {
+    errorEx(GlobalAssertionFailureBuffer, GlobalAssertionFailureBufferSize,
+            ErrLazySymbolNotFound, Name, Length);
+    longjmp(GlobalAssertionFailureReturnPoint, 1);
+  }
+
+  Slot->Target = Addr;
+  return Addr;
+}
+
+#if defined(__arm__) && defined(__thumb__)
+// Entered from a stub with the slot address in r12. Save the arguments,
+// resolve the target and tail-call it with the original lr.
+__attribute__((naked)) void __ez_clang_lazy_trampoline() {
+  asm volatile("push {r0-r4, lr}\n"
+               "mov r0, r12\n"
+               "bl __ez_clang_lazy_resolve\n"
+               "ldr r1, [sp, #20]\n" // Restore lr
+               "mov lr, r1\n"
+               "str r0, [sp, #20]\n" // Replace it with the target
+               "pop {r0-r4}\n"
+               "pop {pc}\n");
+}
+#endif
+
+} // extern "C"
@@ -1,6 +1,7 @@
 #include "ez/protocol.h"
 
 #include "ez/assert.h"
+#include "ez/crc.h"
 #include "ez/response.h"
 #include "ez/serialize.h"
 #include "ez/support.h"
@@ -8,18 +9,127 @@
 
 #include <cstring>
 
-constexpr uint32_t MessageHeaderSize = 32;
+#ifdef EZ_CLANG_FRAME_CRC
+// Frames end with a CRC-32 over header and payload. The size field in the
+// header accounts for it.
+constexpr uint32_t MessageTrailerSize = 4;
 
-void sendMessage(EPCOpCode OpC, uint32_t SeqNo, const char Payload[],
-                 uint32_t PayloadSize) {
-  char HeaderBuffer[MessageHeaderSize];
+// Give up and hang up after this many corrupt frames in a row
+constexpr uint32_t MaxCorruptFrames = 8;
+
+// Once a frame started, consider it truncated if no byte arrives in time
+constexpr uint32_t FrameGapMillis = 100;
+
+// Last frame that can be retransmitted on request from the host. Payload of
+// Setup and Result messages stays in the MessageBuffer until the next message
+// with a payload arrives. We keep the CRC that went out with it, so we can tell
+// if the payload got overwritten in the meantime. Reports are fire-and-forget.
+struct SentFrame {
+  EPCOpCode OpC;
+  uint32_t SeqID;
+  const char *Payload;
+  uint32_t PayloadSize;
+  uint32_t Crc;
+};
+
+static SentFrame LastSent{Hangup, 0, nullptr, 0, 0};
+#else
+constexpr uint32_t MessageTrailerSize = 0;
+#endif
+
+EZ_CLANG_RAMFUNC
+static void writeHeader(char *HeaderBuffer, EPCOpCode OpC, uint32_t SeqNo,
+                        uint32_t PayloadSize) {
   char *Data = HeaderBuffer;
-  Data += writeUInt64(Data, PayloadSize + MessageHeaderSize);
+  Data += writeUInt64(Data, PayloadSize + MessageHeaderSize + MessageTrailerSize);
   Data += writeUInt64(Data, OpC);
   Data += writeUInt64(Data, SeqNo);
   Data += writeUInt64(Data, 0);
-  device_sendBytes(HeaderBuffer, MessageHeaderSize);
-  device_sendBytes(Payload, PayloadSize);
+}
+
+// Send header and payload from separate buffers or, if Payload is null, from
+// a contiguous frame in HeaderBuffer. Returns the frame's CRC (if enabled).
+EZ_CLANG_RAMFUNC
+static uint32_t sendFrameParts(const char *HeaderBuffer, const char Payload[],
+                           uint32_t PayloadSize) {
+#ifdef EZ_CLANG_FRAME_CRC
+  uint32_t Crc = crc32(0, HeaderBuffer, MessageHeaderSize);
+  Crc = crc32(Crc, Payload ? Payload : HeaderBuffer + MessageHeaderSize,
+              PayloadSize);
+  char TrailerBuffer[MessageTrailerSize];
+  writeUInt32(TrailerBuffer, Crc);
+#endif
+  IOVec Parts[] {
+    { HeaderBuffer, Payload ? MessageHeaderSize : MessageHeaderSize + PayloadSize },
+    { Payload, Payload ? PayloadSize : 0 },
+#ifdef EZ_CLANG_FRAME_CRC
+    { TrailerBuffer, MessageTrailerSize },
+#endif
+  };
+  device_sendv(Parts, c_array_size(Parts));
+#ifdef EZ_CLANG_FRAME_CRC
+  return Crc;
+#else
+  return 0;
+#endif
+}
+
+static uint32_t sendFrame(EPCOpCode OpC, uint32_t SeqNo, const char Payload[],
+                          uint32_t PayloadSize) {
+  char HeaderBuffer[MessageHeaderSize];
+  writeHeader(HeaderBuffer, OpC, SeqNo, PayloadSize);
+  return sendFrameParts(HeaderBuffer, Payload, PayloadSize);
+}
+
+void sendMessage(EPCOpCode OpC, uint32_t SeqNo, const char Payload[],
+                 uint32_t PayloadSize) {
+  uint32_t Crc = sendFrame(OpC, SeqNo, Payload, PayloadSize);
+#ifdef EZ_CLANG_FRAME_CRC
+  if (OpC == Setup || OpC == Result)
+    LastSent = SentFrame{OpC, SeqNo, Payload, PayloadSize, Crc};
+#else
+  (void)Crc;
+#endif
+}
+
+EZ_CLANG_RAMFUNC
+void sendMessageInPlace(EPCOpCode OpC, uint32_t SeqNo, char Frame[],
+                        uint32_t PayloadSize) {
+  writeHeader(Frame, OpC, SeqNo, PayloadSize);
+  uint32_t Crc = sendFrameParts(Frame, nullptr, PayloadSize);
+#ifdef EZ_CLANG_FRAME_CRC
+  if (OpC == Setup || OpC == Result)
+    LastSent = SentFrame{OpC, SeqNo, Frame + MessageHeaderSize, PayloadSize, Crc};
+#else
+  (void)Crc;
+#endif
+}
+
+void sendMessagev(EPCOpCode OpC, uint32_t SeqNo, const IOVec Payload[],
+                  uint32_t NumParts) {
+  constexpr uint32_t MaxParts = 4;
+  assert(NumParts <= MaxParts, "Too many payload parts");
+  uint32_t PayloadSize = 0;
+  for (uint32_t i = 0; i < NumParts; i += 1)
+    PayloadSize += Payload[i].Size;
+
+  char HeaderBuffer[MessageHeaderSize];
+  writeHeader(HeaderBuffer, OpC, SeqNo, PayloadSize);
+
+  IOVec Parts[1 + MaxParts + 1];
+  uint32_t Count = 0;
+  Parts[Count++] = IOVec{HeaderBuffer, MessageHeaderSize};
+  for (uint32_t i = 0; i < NumParts; i += 1)
+    Parts[Count++] = Payload[i];
+#ifdef EZ_CLANG_FRAME_CRC
+  uint32_t Crc = 0;
+  for (uint32_t i = 0; i < Count; i += 1)
+    Crc = crc32(Crc, Parts[i].Data, Parts[i].Size);
+  char TrailerBuffer[MessageTrailerSize];
+  writeUInt32(TrailerBuffer, Crc);
+  Parts[Count++] = IOVec{TrailerBuffer, MessageTrailerSize};
+#endif
+  device_sendv(Parts, Count);
 }
 
 void waitForHandshake() {
@@ -56,6 +166,17 @@ void sendSetupMessage(char Buffer[], SetupInfo Info) {
     Data += writeUInt64(Data, Info.Symbols[i].Addr);
   }
 
+  // Regions go last, so hosts that don't know them can ignore them
+  Data += writeUInt64(Data, Info.NumRegions);
+  for (size_t i = 0; i < Info.NumRegions; i++) {
+    const MemoryRegion &R = Info.Regions[i];
+    Data += writeUInt64(Data, R.Kind);
+    Data += writeUInt64(Data, R.Bank);
+    Data += writeUInt64(Data, R.Flags);
+    Data += writeUInt64(Data, ptr2addr(R.Begin));
+    Data += writeUInt64(Data, R.End - R.Begin);
+  }
+
   sendMessage(Setup, 0, Buffer, Data - Buffer);
 }
 
@@ -70,9 +191,79 @@ void sendHangupMessage(uint8_t ErrCode) {
   }
 }
 
-bool receiveMessage(char Buffer[], uint32_t BufferSize, HeaderInfo &Msg) {
-  if (!device_receiveBytes(Buffer, MessageHeaderSize))
+#ifdef EZ_CLANG_FRAME_CRC
+// Receive the rest of a frame that already started. Returns false if the
+// stream stalls, e.g. because bytes got lost on the way.
+EZ_CLANG_RAMFUNC
+static bool receiveBytesWithin(char Buffer[], uint32_t Count) {
+  uint32_t Timeout = device_getCycleCounterFrequency() / 1000 * FrameGapMillis;
+  uint32_t LastProgress = device_readCycleCounter();
+  while (Count > 0) {
+    uint32_t Now = device_readCycleCounter();
+    if (uint32_t Received = device_receiveBytesPartial(Buffer, Count)) {
+      Buffer += Received;
+      Count -= Received;
+      LastProgress = Now;
+    } else if (Now - LastProgress > Timeout) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Drop the remains of a corrupt frame: wait until the line is quiet
+static void discardInput() {
+  char Scratch[16];
+  while (receiveBytesWithin(Scratch, sizeof(Scratch)))
+    ;
+}
+
+// Check that the payload of the last frame is still the one we sent
+static bool lastSentIntact() {
+  if (!LastSent.Payload)
+    return false;
+  char HeaderBuffer[MessageHeaderSize];
+  writeHeader(HeaderBuffer, LastSent.OpC, LastSent.SeqID, LastSent.PayloadSize);
+  uint32_t Crc = crc32(0, HeaderBuffer, MessageHeaderSize);
+  Crc = crc32(Crc, LastSent.Payload, LastSent.PayloadSize);
+  return Crc == LastSent.Crc;
+}
+#else
+EZ_CLANG_RAMFUNC
+static bool receiveBytesWithin(char Buffer[], uint32_t Count) {
+  return device_receiveBytes(Buffer, Count);
+}
+#endif
+
+enum FrameStatus { FrameValid, FrameError, FrameCorrupt };
+
+// Receive more bytes of the current frame and keep track of the time we spend
+// waiting for them. It depends on the link speed rather than the device.
+EZ_CLANG_RAMFUNC
+static bool receiveFrameBytes(char Buffer[], uint32_t Count, HeaderInfo &Msg) {
+  uint32_t Begin = device_readCycleCounter();
+  bool Received = receiveBytesWithin(Buffer, Count);
+  Msg.ReceiveCycles += device_readCycleCounter() - Begin;
+  return Received;
+}
+
+EZ_CLANG_RAMFUNC
+static FrameStatus receiveFrame(char Buffer[], uint32_t BufferSize,
+                                HeaderInfo &Msg) {
+  // Block until the next frame starts. The header goes into a separate buffer,
+  // so the last response in Buffer survives a retransmission request.
+  char Header[MessageHeaderSize];
+  if (!device_receiveBytes(Header, 1))
     fail("Error receiving message header. Shutting down.");
+  Msg.FrameBegin = device_readCycleCounter();
+  Msg.ReceiveCycles = 0;
+  if (!receiveFrameBytes(Header + 1, MessageHeaderSize - 1, Msg)) {
+#ifdef EZ_CLANG_FRAME_CRC
+    return FrameCorrupt;
+#else
+    fail("Error receiving message header. Shutting down.");
+#endif
+  }
 
   // All header fields are 64-bit
   uint64_t Bytes;
@@ -80,8 +271,7 @@ bool receiveMessage(char Buffer[], uint32_t BufferSize, HeaderInfo &Msg) {
   uint64_t SeqID;
   uint64_t TagAddr;
 
-  // Parse them all, so we can re-use the buffer for the payload
-  const char *Data = Buffer;
+  const char *Data = Header;
   Data += readUInt64(Data, Bytes);
   Data += readUInt64(Data, OpCode);
   Data += readUInt64(Data, SeqID);
@@ -90,52 +280,122 @@ bool receiveMessage(char Buffer[], uint32_t BufferSize, HeaderInfo &Msg) {
   // If any of these values exceeds the 32-bit range, we got a malformed header
   if (Bytes >= 0x100000000 || OpCode >= 0x100000000 ||
       SeqID >= 0x100000000 || TagAddr >= 0x100000000) {
-    // Each hex line shows 8 Bytes (16 chars) + 8 spaces + newline + zero
-    char BytesHex[26];
-    char OpCodeHex[26];
-    char SeqIDHex[26];
-    char TagAddrHex[26];
-    formatlnBytesHex(BytesHex, Buffer, 8);
-    formatlnBytesHex(OpCodeHex, Buffer + 8, 8);
-    formatlnBytesHex(SeqIDHex, Buffer + 16, 8);
-    formatlnBytesHex(TagAddrHex, Buffer + 24, 8);
-    errorEx(Buffer, BufferSize,
-            "Message header invalid: All values must be in 32-bit range. "
-            "Received bytes interpretation:\n"
-            "  Length:  %s"
-            "  Opcode:  %s"
-            "  SeqID:   %s"
-            "  TagAddr: %s"
-            , BytesHex, OpCodeHex, SeqIDHex, TagAddrHex);
+#ifdef EZ_CLANG_FRAME_CRC
+    return FrameCorrupt;
+#else
+    errorEx(Buffer, BufferSize, ErrHeaderOutOfRange, Header, MessageHeaderSize);
     device_flushReceiveBuffer();
-    return false;
+    return FrameError;
+#endif
   }
 
+  // Error responses refer to the sequence ID of the failed request
+  Msg.SeqID = SeqID;
+
+#ifdef EZ_CLANG_FRAME_CRC
+  // Without a trusted size field, we can't tell where the frame ends
+  if (Bytes < MessageHeaderSize + MessageTrailerSize)
+    return FrameCorrupt;
+
+  // Consume payloads that exceed the buffer chunk-wise without storing them.
+  // This way we can tell a corrupt size field from a genuine protocol error.
+  // Only calls carry a payload we need. Anything else goes to a scratch buffer,
+  // so the last response survives for retransmission.
+  uint32_t Crc = crc32(0, Header, MessageHeaderSize);
+  Bytes -= MessageHeaderSize + MessageTrailerSize;
+  char Scratch[16];
+  char *Dest = OpCode == Call ? Buffer : Scratch;
+  uint32_t DestSize = OpCode == Call ? BufferSize : sizeof(Scratch);
+  uint32_t Remaining = Bytes;
+  while (Remaining > 0) {
+    uint32_t Chunk = Remaining < DestSize ? Remaining : DestSize;
+    if (!receiveFrameBytes(Dest, Chunk, Msg))
+      return FrameCorrupt;
+    Crc = crc32(Crc, Dest, Chunk);
+    Remaining -= Chunk;
+  }
+
+  char Trailer[MessageTrailerSize];
+  uint32_t Expected;
+  if (!receiveFrameBytes(Trailer, MessageTrailerSize, Msg))
+    return FrameCorrupt;
+  readUInt32(Trailer, Expected);
+  if (Crc != Expected)
+    return FrameCorrupt;
+
+  if (Bytes > BufferSize) {
+    errorEx(Buffer, BufferSize, ErrPayloadExceedsBuffer, nullptr, 0, Bytes,
+            BufferSize);
+    return FrameError;
+  }
+
+  if (OpCode != Call && OpCode != Hangup && OpCode != Nak) {
+    errorEx(Buffer, BufferSize, ErrUnexpectedOpCode, nullptr, 0, OpCode);
+    return FrameError;
+  }
+#else
   // Check that payload contents fits the buffer
   Bytes -= MessageHeaderSize;
   if (Bytes > BufferSize) {
-    errorEx(Buffer, BufferSize,
-            "Message payload (%lu bytes) exceeds buffer size (%lu bytes)",
-            Bytes, BufferSize);
+    errorEx(Buffer, BufferSize, ErrPayloadExceedsBuffer, nullptr, 0, Bytes,
+            BufferSize);
     device_flushReceiveBuffer();
-    return false;
+    return FrameError;
   }
 
   // Validate Opcode
   if (OpCode != Call && OpCode != Hangup) {
-    device_receiveBytes(Buffer, Bytes);
-    errorEx(Buffer, BufferSize, "Received unexpected message op-code: %lu",
-            OpCode);
-    return false;
+    receiveFrameBytes(Buffer, Bytes, Msg);
+    errorEx(Buffer, BufferSize, ErrUnexpectedOpCode, nullptr, 0, OpCode);
+    return FrameError;
   }
 
+  if (!receiveFrameBytes(Buffer, Bytes, Msg))
+    return FrameError;
+#endif
+
   // TODO: At some point, allow to validate endpoint and function addresses!
   if (OpCode == Call)
     Msg.Handler = reinterpret_cast<RPCEndpoint *>(addr2ptr(TagAddr));
 
   Msg.PayloadBytes = Bytes;
   Msg.OpCode = OpCode;
-  Msg.SeqID = SeqID;
+  return FrameValid;
+}
 
-  return device_receiveBytes(Buffer, Bytes);
+EZ_CLANG_RAMFUNC
+bool receiveMessage(char Buffer[], uint32_t BufferSize, HeaderInfo &Msg) {
+  Msg.SeqID = 0;
+#ifdef EZ_CLANG_FRAME_CRC
+  uint32_t CorruptFrames = 0;
+  while (true) {
+    FrameStatus Status = receiveFrame(Buffer, BufferSize, Msg);
+    if (Status == FrameCorrupt) {
+      // Ask the host to retransmit its last frame
+      if (++CorruptFrames > MaxCorruptFrames)
+        fail("Too many corrupt frames. Shutting down.");
+      discardInput();
+      sendFrame(Nak, Msg.SeqID, nullptr, 0);
+      continue;
+    }
+    if (Status == FrameValid && Msg.OpCode == Nak) {
+      // StreamData frames have no sequence number and we don't keep them for
+      // retransmission. Once the Setup went out, a Nak for sequence number 0
+      // refers to a lost stream chunk. The host sees the gap in the record
+      // index of the next chunk, so we ignore it.
+      if (Msg.SeqID == 0 && LastSent.OpC != Setup)
+        continue;
+      // The host asks us to retransmit our last frame. If we can't, the host
+      // would wait forever, so we hang up.
+      if (Msg.SeqID != LastSent.SeqID || !lastSentIntact())
+        fail("Cannot retransmit the requested frame. Shutting down.");
+      sendFrame(LastSent.OpC, LastSent.SeqID, LastSent.Payload,
+                LastSent.PayloadSize);
+      continue;
+    }
+    return Status == FrameValid;
+  }
+#else
+  return receiveFrame(Buffer, BufferSize, Msg) == FrameValid;
+#endif
 }
@@ -0,0 +1,254 @@
+#include "ez/abi.h"
+
+#include "ez/assert.h"
+#include "ez/response.h"
+#include "ez/serialize.h"
+#include "ez/stats.h"
+#include "ez/support.h"
+#include "ez/symbols.h"
+#include "ez/veneer.h"
+
+#include <cstring>
+
+//
+// Load a relocatable module: The host sends section contents, the names of
+// external symbols and relocation records. The device lays out the sections
+// in the given region, resolves the names against its own symbol tables and
+// applies the relocations. There is no lookup round trip and the same request
+// can be re-sent for a different region.
+//
+// Input:
+//   Region address, region size
+//   NumSections, for each: alignment, size, content (size-prefixed, the rest
+//   of the section is zero-filled)
+//   NumSymbols, for each: name (size-prefixed)
+//   NumRelocs, for each: section index, offset, type, target, addend
+//   Targets below NumSections refer to section addresses, others to symbol
+//   (target - NumSections). Addends are explicit like in ELF RELA records.
+//
+// Output:
+//   HasError, NumSections + addresses, NumSymbols + addresses, bytes used in
+//   the region (including veneers)
+//
+
+// ELF relocation types we support (Thumb code on Cortex-M)
+enum RelocType : uint32_t {
+  R_ARM_ABS32 = 2,
+  R_ARM_REL32 = 3,
+  R_ARM_THM_CALL = 10,
+  R_ARM_THM_JUMP24 = 30,
+  R_ARM_THM_MOVW_ABS_NC = 47,
+  R_ARM_THM_MOVT_ABS = 48,
+};
+
+static uint16_t readHalf(const char *P) {
+  return static_cast<uint8_t>(P[0]) | (static_cast<uint8_t>(P[1]) << 8);
+}
+
+static void writeHalf(char *P, uint16_t Value) {
+  P[0] = static_cast<char>(Value & 0xFF);
+  P[1] = static_cast<char>(Value >> 8);
+}
+
+static uint32_t readWord(const char *P) {
+  return readHalf(P) | (static_cast<uint32_t>(readHalf(P + 2)) << 16);
+}
+
+static void writeWord(char *P, uint32_t Value) {
+  writeHalf(P, Value & 0xFFFF);
+  writeHalf(P + 2, Value >> 16);
+}
+
+// Encode the offset of a BL (call) or B.W instruction. Returns false if it's
+// out of range (+/-16MB).
+static bool encodeThumbBranch(char *P, int32_t Offset, bool IsCall) {
+  if (Offset < -(1 << 24) || Offset >= (1 << 24))
+    return false;
+  uint32_t S = (Offset >> 24) & 1;
+  uint32_t I1 = (Offset >> 23) & 1;
+  uint32_t I2 = (Offset >> 22) & 1;
+  uint32_t J1 = ~(I1 ^ S) & 1;
+  uint32_t J2 = ~(I2 ^ S) & 1;
+  uint32_t Imm10 = (Offset >> 12) & 0x3FF;
+  uint32_t Imm11 = (Offset >> 1) & 0x7FF;
+  writeHalf(P, 0xF000 | (S << 10) | Imm10);
+  writeHalf(P + 2, (IsCall ? 0xD000 : 0x9000) | (J1 << 13) | (J2 << 11) | Imm11);
+  return true;
+}
+
+// Replace the immediate of a MOVW/MOVT instruction, keep op-code and register
+static void encodeThumbMovImm16(char *P, uint16_t Imm) {
+  uint16_t Hi = readHalf(P);
+  uint16_t Lo = readHalf(P + 2);
+  Hi = (Hi & 0xFBF0) | ((Imm >> 1) & 0x0400) | ((Imm >> 12) & 0x000F);
+  Lo = (Lo & 0x8F00) | ((Imm << 4) & 0x7000) | (Imm & 0x00FF);
+  writeHalf(P, Hi);
+  writeHalf(P + 2, Lo);
+}
+
+// Size of the section with the given index from the section records in the
+// input. Modules have a handful of sections, so a linear walk is fine.
+static uint32_t getSectionSize(const char *Data, uint32_t Index) {
+  for (uint32_t i = 0;; i += 1) {
+    uint32_t Align;
+    uint32_t SectionSize;
+    uint32_t ContentSize;
+    Data += readSize(Data, Align);
+    Data += readSize(Data, SectionSize);
+    Data += readSize(Data, ContentSize);
+    if (i == Index)
+      return SectionSize;
+    Data += ContentSize;
+  }
+}
+
+// Branches that don't reach their target go through a veneer at the end of the
+// region. Allocate one for the given target or reuse an existing one.
+static char *getVeneer(char *Begin, char *&End, const char *Limit,
+                       uint32_t Target) {
+  for (char *V = Begin; V < End; V += VeneerSize)
+    if (readWord(V + VeneerTargetOffset) == (Target | 1))
+      return V;
+  if (End + VeneerSize > Limit)
+    return nullptr;
+  char *V = End;
+  writeVeneer(V, Target);
+  End += VeneerSize;
+  return V;
+}
+
+char *__ez_clang_rpc_load_relocatable(const char *Data, size_t Size) {
+  const char *DataBegin = Data;
+
+  uint32_t RegionAddr;
+  uint32_t RegionSize;
+  Data += readAddr(Data, RegionAddr);
+  Data += readSize(Data, RegionSize);
+  char *Region = addr2ptr(RegionAddr);
+  char *RegionEnd = Region + RegionSize;
+
+  // Lay out and copy sections. Their addresses go into the response right
+  // away and we read them back from there when processing relocations.
+  uint32_t NumSections;
+  Data += readSize(Data, NumSections);
+  const char *SectionRecords = Data;
+  char *SectionAddrs = responseAcquire(1 + 8 + 8 * NumSections);
+  char *Resp = SectionAddrs;
+  Resp += writeBool(Resp, false); // HasError
+  Resp += writeUInt64(Resp, NumSections);
+  SectionAddrs = Resp;
+
+  char *Cursor = Region;
+  for (uint32_t i = 0; i < NumSections; i += 1) {
+    uint32_t Align;
+    uint32_t SectionSize;
+    uint32_t ContentSize;
+    Data += readSize(Data, Align);
+    Data += readSize(Data, SectionSize);
+    Data += readSize(Data, ContentSize);
+    assert(is_power_of_2(Align), "Invalid section alignment");
+    assert(ContentSize <= SectionSize, "Invalid section content size");
+    Cursor = addr2ptr((ptr2addr(Cursor) + Align - 1) & ~(Align - 1));
+    if (Cursor + SectionSize > RegionEnd)
+      return error(ErrRelocRegionTooSmall, RegionSize, RegionAddr);
+    memcpy(Cursor, Data, ContentSize);
+    memset(Cursor + ContentSize, 0, SectionSize - ContentSize);
+    Data += ContentSize;
+    Resp += writeUInt64(Resp, ptr2addr(Cursor));
+    Cursor += SectionSize;
+  }
+
+  // Resolve external symbols
+  uint32_t NumSymbols;
+  Data += readSize(Data, NumSymbols);
+  char *SymbolAddrs = responseAcquire(8 + 8 * NumSymbols + 8);
+  Resp = SymbolAddrs;
+  Resp += writeUInt64(Resp, NumSymbols);
+  SymbolAddrs = Resp;
+  for (uint32_t i = 0; i < NumSymbols; i += 1) {
+    uint32_t Length;
+    Data += readSize(Data, Length);
+    uint32_t Addr = lookupBuiltinSymbol(Data, Length);
+    if (!Addr)
+      Addr = lookupSymbol(Data, Length);
+    if (!Addr)
+      return errorDetail(ErrRelocSymbolNotFound, Data, Length, i);
+    Resp += writeUInt64(Resp, Addr);
+    Data += Length;
+  }
+
+  // Veneers go after the sections
+  char *VeneersBegin = align_ptr<4>(Cursor);
+  char *VeneersEnd = VeneersBegin;
+
+  uint32_t NumRelocs;
+  Data += readSize(Data, NumRelocs);
+  for (uint32_t i = 0; i < NumRelocs; i += 1) {
+    uint32_t Section;
+    uint32_t Offset;
+    uint32_t Type;
+    uint32_t Target;
+    int32_t Addend;
+    Data += readSize(Data, Section);
+    Data += readSize(Data, Offset);
+    Data += readUInt64as32(Data, Type);
+    Data += readUInt64as32(Data, Target);
+    Data += readSInt64as32(Data, Addend);
+    assert(Section < NumSections, "Invalid relocation section");
+    assert(Target < NumSections + NumSymbols, "Invalid relocation target");
+
+    // All supported relocations patch a 4-byte field
+    constexpr uint32_t FixupSize = 4;
+    uint32_t SectionSize = getSectionSize(SectionRecords, Section);
+    if (SectionSize < FixupSize || Offset > SectionSize - FixupSize)
+      return error(ErrRelocOffset, Offset, Section, SectionSize);
+
+    uint32_t SectionAddr;
+    readAddr(SectionAddrs + 8 * Section, SectionAddr);
+    char *P = addr2ptr(SectionAddr + Offset);
+    uint32_t S;
+    if (Target < NumSections)
+      readAddr(SectionAddrs + 8 * Target, S);
+    else
+      readAddr(SymbolAddrs + 8 * (Target - NumSections), S);
+
+    switch (Type) {
+    case R_ARM_ABS32:
+      writeWord(P, S + Addend);
+      break;
+    case R_ARM_REL32:
+      writeWord(P, S + Addend - ptr2addr(P));
+      break;
+    case R_ARM_THM_CALL:
+    case R_ARM_THM_JUMP24: {
+      // Branch offsets are relative to P + 4
+      bool IsCall = (Type == R_ARM_THM_CALL);
+      uint32_t Dest = S + Addend + 4;
+      int32_t Delta = static_cast<int32_t>(Dest - (ptr2addr(P) + 4));
+      if (encodeThumbBranch(P, Delta, IsCall))
+        break;
+      char *V = getVeneer(VeneersBegin, VeneersEnd, RegionEnd, Dest);
+      if (!V)
+        return error(ErrRelocRegionTooSmall, RegionSize, RegionAddr);
+      Delta = static_cast<int32_t>(ptr2addr(V) - (ptr2addr(P) + 4));
+      if (!encodeThumbBranch(P, Delta, IsCall))
+        return error(ErrRelocOutOfRange, Type, Offset, Section);
+      break;
+    }
+    case R_ARM_THM_MOVW_ABS_NC:
+      encodeThumbMovImm16(P, (S + Addend) & 0xFFFF);
+      break;
+    case R_ARM_THM_MOVT_ABS:
+      encodeThumbMovImm16(P, (S + Addend) >> 16);
+      break;
+    default:
+      return error(ErrRelocUnsupported, Type, Offset, Section);
+    }
+  }
+
+  assert(Data == DataBegin + Size, "Invalid input length");
+  statsTrackCodeBuffer(VeneersEnd);
+
+  Resp += writeUInt64(Resp, VeneersEnd - Region);
+  return responseFinalize(Resp);
+}
@@ -1,32 +1,42 @@
 #include "ez/response.h"
 
 #include "ez/assert.h"
+#include "ez/protocol.h"
 #include "ez/serialize.h"
 #include "ez/support.h"
 
-#include <cstdarg>
 #include <cstddef>
-#include <cstdio>
 #include <cstring>
 
 char *ResponsePtr = nullptr;
 char *ResponseBuffer = nullptr;
 const char *ResponseLimit = nullptr;
+char *ResponseInputBegin = nullptr;
+uint32_t ResponseHeaderRoom = 0;
+uint32_t ResponseSeqID = 0;
+bool ResponsePartsEnabled = false;
 
 void responseClearBuffer() {
   ResponsePtr = nullptr;
   ResponseBuffer = nullptr;
   ResponseLimit = nullptr;
+  ResponseInputBegin = nullptr;
+  ResponsePartsEnabled = false;
 }
 
-const char *responseSetBuffer(char *Buffer, size_t Capacity) {
+const char *responseSetBuffer(char *Buffer, size_t Capacity,
+                              size_t HeaderRoom, char *InputBegin) {
   assert(ResponseBuffer == nullptr && ResponsePtr == nullptr &&
          ResponseLimit == nullptr, "Response not cleared?");
-  ResponseBuffer = align_ptr<64>(Buffer);
+  // Leave room in front of the response, so the caller can put the message
+  // header there and send the whole frame in one go
+  ResponseBuffer = align_ptr<64>(Buffer + HeaderRoom);
   uint32_t Padding = ResponseBuffer - Buffer;
   memset(Buffer, 0, Padding);
   ResponsePtr = ResponseBuffer;
   ResponseLimit = Buffer + Capacity;
+  ResponseInputBegin = InputBegin ? InputBegin : Buffer;
+  ResponseHeaderRoom = HeaderRoom;
   return ResponseBuffer;
 }
 
@@ -38,6 +48,49 @@ char *responseAcquire(uint32_t ExpectedBytes) {
   return Trange;
 }
 
+void responseSetSeqID(uint32_t SeqID) {
+  ResponseSeqID = SeqID;
+  ResponsePartsEnabled = true;
+}
+
+// Send [ResponseBuffer, ResponseEnd) as a ResultPart message. The header goes
+// into the room that responseSetBuffer() left in front of the buffer.
+static char *responseFlush(char *ResponseEnd) {
+  assert(ResponsePartsEnabled, "Multi-part response not available");
+  assert(ResponseEnd > ResponseBuffer, "Response tranche exceeds buffer");
+  sendMessageInPlace(ResultPart, ResponseSeqID,
+                     ResponseBuffer - MessageHeaderSize,
+                     ResponseEnd - ResponseBuffer);
+  ResponsePtr = ResponseBuffer;
+  return ResponseBuffer;
+}
+
+// Acquire Bytes at ResponseEnd. Flush first if they don't fit anymore.
+char *responseReserve(char *ResponseEnd, uint32_t Bytes) {
+  assert(ResponseEnd <= ResponsePtr, "Missed to acquire response memory?");
+  if (ResponseEnd + Bytes > ResponseLimit)
+    ResponseEnd = responseFlush(ResponseEnd);
+  ResponsePtr = ResponseEnd;
+  return responseAcquire(Bytes);
+}
+
+// Copy Size bytes to ResponseEnd, flushing as often as necessary
+char *responseWriteBytes(char *ResponseEnd, const char *Data, uint32_t Size) {
+  while (Size > 0) {
+    if (ResponseEnd == ResponseLimit)
+      ResponseEnd = responseFlush(ResponseEnd);
+    uint32_t Chunk = ResponseLimit - ResponseEnd;
+    if (Chunk > Size)
+      Chunk = Size;
+    ResponseEnd = responseReserve(ResponseEnd, Chunk);
+    memcpy(ResponseEnd, Data, Chunk);
+    ResponseEnd += Chunk;
+    Data += Chunk;
+    Size -= Chunk;
+  }
+  return ResponseEnd;
+}
+
 char *responseFinalize(char *ResponseEnd) {
   assert(ResponseEnd <= ResponsePtr, "Missed to acquire response memory?");
   return ResponseEnd;
@@ -53,7 +106,14 @@ const char *responseGetLimit() {
   return ResponseLimit;
 }
 
-// Error format: error code, message length, message
+// Error format: error status, record length, record. The record has a fixed
+// size part with the error code and four argument words, followed by an
+// optional detail blob. Message templates are kept on the host (errors.def).
+constexpr uint32_t ErrorNumArgs = 4;
+constexpr uint32_t ErrorRecordSize = 8 + ErrorNumArgs * 8;
+constexpr uint32_t ErrorHeaderSize = 1 + 8;
+constexpr uint32_t ErrorFixedSize = ErrorHeaderSize + ErrorRecordSize;
+
 static char *errorAllocate(char *Buffer) {
   ResponsePtr = Buffer;
   Buffer += writeBool(Buffer, true); // HasError
@@ -64,52 +124,62 @@ static char *errorAllocate(char *Buffer) {
 char *errorFinalize(uint32_t Length) {
   char *Err = ResponsePtr + 1;
   Err += writeUInt64(Err, Length);
-  return Err + Length; // Not including terminating null
+  return Err + Length;
 }
 
 const char *errorGetBuffer(uint32_t &Size) {
   readSize(ResponsePtr + 1, Size);
-  Size += 1 + 8; // Error status + message length field
+  Size += ErrorHeaderSize; // Error status + record length field
   return ResponsePtr;
 }
 
-char *error(const char *Fmt, ...) {
+// Error responses always start at the beginning of the response buffer. If
+// the input left too little room for the error record, the handler is done
+// with its input anyway, so we move the response buffer to the beginning of
+// the input.
+static char *errorResponseBuffer(uint32_t &Size) {
   assert(ResponseBuffer != nullptr, "Set to end of input buffer first");
-  va_list Args;
-  va_start(Args, Fmt);
-  uint32_t Size = ResponseLimit - ResponseBuffer;
-  uint32_t Length = vsnprintf(errorAllocate(ResponseBuffer), Size, Fmt, Args);
-  va_end(Args);
-  return errorFinalize(Length);
-}
-
-char *errorEx(char *Buffer, uint32_t Size, const char *Fmt, ...) {
-  va_list Args;
-  va_start(Args, Fmt);
-  uint32_t Length = vsnprintf(errorAllocate(Buffer), Size, Fmt, Args);
-  va_end(Args);
-  return errorFinalize(Length);
-}
-
-uint32_t formatlnBytesHex(char Buffer[], const char *Bytes,
-                          size_t BytesRemaining, size_t LineMax) {
-  if (BytesRemaining <= 0)
-    return 0;
-
-  char *Out = Buffer;
-  constexpr const char *HexDigits = "0123456789ABCDEF";
-  size_t iMax = BytesRemaining;
-  if (LineMax > 0 && LineMax < BytesRemaining)
-    iMax = LineMax;
-
-  for (size_t i = 0; i < iMax; i += 1) {
-    Out[0] = HexDigits[Bytes[i] >> 4];    // lo hex
-    Out[1] = HexDigits[Bytes[i] & 0x0F];  // hi hex
-    Out[2] = ' ';
-    Out += 3;
+  uint32_t Remaining = ResponseLimit - ResponseBuffer;
+  if (Remaining < ErrorFixedSize) {
+    ResponseBuffer = align_ptr<64>(ResponseInputBegin + ResponseHeaderRoom);
+    ResponsePtr = ResponseBuffer;
   }
+  Size = ResponseLimit - ResponseBuffer;
+  return ResponseBuffer;
+}
+
+char *error(ErrorCode Code, uint32_t Arg0, uint32_t Arg1, uint32_t Arg2,
+            uint32_t Arg3) {
+  return errorDetail(Code, nullptr, 0, Arg0, Arg1, Arg2, Arg3);
+}
+
+char *errorDetail(ErrorCode Code, const char *Detail, uint32_t DetailSize,
+                  uint32_t Arg0, uint32_t Arg1, uint32_t Arg2, uint32_t Arg3) {
+  uint32_t Size;
+  char *Buffer = errorResponseBuffer(Size);
+  return errorEx(Buffer, Size, Code, Detail, DetailSize, Arg0, Arg1, Arg2,
+                 Arg3);
+}
 
-  Out[0] = '\n';
-  Out[1] = '\0';
-  return Out - Buffer + 1; // Not including terminating zero
+char *errorEx(char *Buffer, uint32_t Size, ErrorCode Code, const char *Detail,
+              uint32_t DetailSize, uint32_t Arg0, uint32_t Arg1, uint32_t Arg2,
+              uint32_t Arg3) {
+  assert(Size >= ErrorFixedSize, "Error buffer too small");
+
+  // Truncate the detail blob if necessary. It may live in the same buffer, so
+  // move it into place before writing the record.
+  uint32_t Capacity = Size > ErrorFixedSize ? Size - ErrorFixedSize : 0;
+  if (DetailSize > Capacity)
+    DetailSize = Capacity;
+  if (DetailSize > 0)
+    memmove(Buffer + ErrorFixedSize, Detail, DetailSize);
+
+  char *Record = errorAllocate(Buffer);
+  Record += writeUInt64(Record, Code);
+  Record += writeUInt64(Record, Arg0);
+  Record += writeUInt64(Record, Arg1);
+  Record += writeUInt64(Record, Arg2);
+  Record += writeUInt64(Record, Arg3);
+
+  return errorFinalize(ErrorRecordSize + DetailSize);
 }
@@ -0,0 +1,230 @@
+#include "ez/schedule.h"
+
+#include "ez/abi.h"
+
+#include "ez/assert.h"
+#include "ez/device.h"
+#include "ez/response.h"
+#include "ez/serialize.h"
+#include "ez/support.h"
+
+#include <cstdint>
+
+//
+// Periodic execution of committed functions from a hardware timer interrupt.
+// The timer runs at the greatest common divisor of all active periods and each
+// slot counts down timer ticks. There is no RPC per iteration.
+//
+// Scheduled functions run in interrupt context: they must be short and they
+// must not send reports, because the message loop might be sending as well.
+// Use __ez_clang_stream_write() to get data out instead.
+//
+
+constexpr uint32_t NumScheduleSlots = 4;
+constexpr uint32_t MinPeriodMicros = 50;
+
+// Jitter is a signed 32-bit deviation in cycles, so a period must fit in 31 bits
+constexpr uint64_t MaxPeriodCycles = 0x7FFFFFFF;
+
+typedef void PeriodicFn();
+
+struct ScheduleSlot {
+  uint32_t FnAddr; // 0 if the slot is free
+  uint32_t PeriodMicros;
+  uint32_t PeriodTicks;
+  uint32_t Countdown;
+  uint32_t PeriodCycles;
+  uint32_t NextRelease;
+  bool Anchored; // NextRelease is valid
+  uint32_t Runs;
+  uint32_t Jitters;
+  uint32_t Overruns;
+  uint32_t MaxJitter;
+  uint64_t SumJitter;
+  uint32_t MaxDuration;
+};
+
+static ScheduleSlot Slots[NumScheduleSlots];
+
+static uint32_t gcd(uint32_t A, uint32_t B) {
+  while (B != 0) {
+    uint32_t T = A % B;
+    A = B;
+    B = T;
+  }
+  return A;
+}
+
+static void onTimerTick() {
+  for (ScheduleSlot &S : Slots) {
+    if (S.FnAddr == 0 || --S.Countdown > 0)
+      continue;
+    S.Countdown = S.PeriodTicks;
+
+    // Jitter is the deviation from the ideal release time
+    uint32_t Begin = device_readCycleCounter();
+    if (S.Anchored) {
+      int32_t Deviation = static_cast<int32_t>(Begin - S.NextRelease);
+      uint32_t Jitter = Deviation < 0 ? -Deviation : Deviation;
+      if (Jitter > S.MaxJitter)
+        S.MaxJitter = Jitter;
+      S.SumJitter += Jitter;
+      S.Jitters += 1;
+      S.NextRelease += S.PeriodCycles;
+    } else {
+      S.NextRelease = Begin + S.PeriodCycles;
+      S.Anchored = true;
+    }
+
+    reinterpret_cast<PeriodicFn *>(static_cast<uintptr_t>(S.FnAddr))();
+
+    uint32_t Duration = device_readCycleCounter() - Begin;
+    if (Duration > S.MaxDuration)
+      S.MaxDuration = Duration;
+    if (Duration > S.PeriodCycles)
+      S.Overruns += 1;
+    S.Runs += 1;
+  }
+}
+
+// Common base period of all active slots, optionally with an extra period
+static uint32_t getBasePeriod(uint32_t ExtraMicros = 0) {
+  uint32_t BaseMicros = ExtraMicros;
+  for (const ScheduleSlot &S : Slots)
+    if (S.FnAddr != 0)
+      BaseMicros = gcd(S.PeriodMicros, BaseMicros);
+  return BaseMicros;
+}
+
+// Restart the timer at the common base period of all active slots. The timer
+// is stopped while we modify the slots. Countdowns start over, so release times
+// are re-anchored on the next run of each slot.
+static bool restartTimer() {
+  uint32_t BaseMicros = getBasePeriod();
+  if (BaseMicros == 0)
+    return true;
+
+  for (ScheduleSlot &S : Slots) {
+    if (S.FnAddr != 0) {
+      S.PeriodTicks = S.PeriodMicros / BaseMicros;
+      S.Countdown = S.PeriodTicks;
+      S.Anchored = false;
+    }
+  }
+  return device_startPeriodicTimer(BaseMicros, onTimerTick);
+}
+
+void scheduleReset() {
+  device_stopPeriodicTimer();
+  for (ScheduleSlot &S : Slots)
+    S = ScheduleSlot{};
+}
+
+extern "C" {
+
+// Input: function address, period in microseconds. Output: HasError, slot.
+char *__ez_clang_rpc_schedule_start(const char *Data, size_t Size) {
+  assert(Size == 16, "Invalid input length");
+
+  uint32_t FnAddr;
+  uint32_t PeriodMicros;
+  Data += readAddr(Data, FnAddr);
+  Data += readUInt64as32(Data, PeriodMicros);
+  if (!isThumbFunction(FnAddr))
+    return error(ErrNonThumbFunction, FnAddr);
+  if (PeriodMicros < MinPeriodMicros)
+    return error(ErrSchedulePeriodTooShort, PeriodMicros, MinPeriodMicros);
+  uint32_t MaxTimerMicros = device_getMaxTimerPeriodMicros();
+  if (MaxTimerMicros == 0)
+    return error(ErrScheduleUnsupported);
+
+  // The period is limited by the jitter measurement and by the timer. The
+  // common base period is never longer than the period itself.
+  uint32_t CyclesPerMicro = device_getCycleCounterFrequency() / 1000000;
+  uint64_t PeriodCycles = static_cast<uint64_t>(CyclesPerMicro) * PeriodMicros;
+  uint32_t MaxPeriodMicros = MaxPeriodCycles / CyclesPerMicro;
+  if (MaxPeriodMicros > MaxTimerMicros)
+    MaxPeriodMicros = MaxTimerMicros;
+  if (PeriodMicros > MaxPeriodMicros)
+    return error(ErrSchedulePeriodTooLong, PeriodMicros, MaxPeriodMicros);
+
+  // The timer runs at the common base period, which must not be too short
+  // either. E.g. 1000us and 1001us would need a 1us timer.
+  uint32_t BaseMicros = getBasePeriod(PeriodMicros);
+  if (BaseMicros < MinPeriodMicros)
+    return error(ErrScheduleBasePeriodTooShort, PeriodMicros, BaseMicros,
+                 MinPeriodMicros);
+
+  uint32_t Index = 0;
+  while (Index < NumScheduleSlots && Slots[Index].FnAddr != 0)
+    Index += 1;
+  if (Index == NumScheduleSlots)
+    return error(ErrScheduleNoFreeSlot, NumScheduleSlots);
+
+  device_stopPeriodicTimer();
+  ScheduleSlot &S = Slots[Index];
+  S = ScheduleSlot{};
+  S.FnAddr = FnAddr;
+  S.PeriodMicros = PeriodMicros;
+  S.PeriodCycles = PeriodCycles;
+  if (!restartTimer()) {
+    S.FnAddr = 0;
+    return error(ErrScheduleUnsupported);
+  }
+
+  char *Resp = responseAcquire(1 + 8);
+  Resp += writeBool(Resp, false); // HasError
+  Resp += writeUInt64(Resp, Index);
+  return responseFinalize(Resp);
+}
+
+// Input: slot. Output: HasError.
+char *__ez_clang_rpc_schedule_stop(const char *Data, size_t Size) {
+  assert(Size == 8, "Invalid input length");
+
+  uint32_t Index;
+  readUInt64as32(Data, Index);
+  if (Index >= NumScheduleSlots || Slots[Index].FnAddr == 0)
+    return error(ErrScheduleInvalidSlot, Index);
+
+  device_stopPeriodicTimer();
+  Slots[Index].FnAddr = 0;
+  restartTimer();
+
+  char *Resp = responseAcquire(1);
+  Resp += writeBool(Resp, false); // HasError
+  return responseFinalize(Resp);
+}
+
+// Output: HasError, counter frequency, number of slots and for each: function
+// address (0 if free), period in microseconds, runs, overruns, max jitter,
+// mean jitter and max duration in cycles.
+char *__ez_clang_rpc_schedule_stats(const char *Data, size_t Size) {
+  assert(Size == 0, "Invalid input length");
+
+  // The timer handler updates the counters, 64-bit SumJitter included. Take a
+  // consistent snapshot first.
+  ScheduleSlot Snapshot[NumScheduleSlots];
+  device_pausePeriodicTimer();
+  for (uint32_t i = 0; i < NumScheduleSlots; i += 1)
+    Snapshot[i] = Slots[i];
+  device_resumePeriodicTimer();
+
+  char *Resp = responseAcquire(1 + 8 + 8 + NumScheduleSlots * 7 * 8);
+  Resp += writeBool(Resp, false); // HasError
+  Resp += writeUInt64(Resp, device_getCycleCounterFrequency());
+  Resp += writeUInt64(Resp, NumScheduleSlots);
+  for (const ScheduleSlot &S : Snapshot) {
+    uint32_t Jitters = S.Jitters > 0 ? S.Jitters : 1;
+    Resp += writeUInt64(Resp, S.FnAddr);
+    Resp += writeUInt64(Resp, S.PeriodMicros);
+    Resp += writeUInt64(Resp, S.Runs);
+    Resp += writeUInt64(Resp, S.Overruns);
+    Resp += writeUInt64(Resp, S.MaxJitter);
+    Resp += writeUInt64(Resp, static_cast<uint32_t>(S.SumJitter / Jitters));
+    Resp += writeUInt64(Resp, S.MaxDuration);
+  }
+  return responseFinalize(Resp);
+}
+
+} // extern "C"
@@ -1,10 +1,23 @@
 #include "ez/serialize.h"
 
 #include "ez/assert.h"
+#include "ez/support.h"
 
 #include <cstring>
 
+// Write 32-bit unsigned integer as 32-bit little endian.
+EZ_CLANG_RAMFUNC
+uint32_t writeUInt32(char *Buffer, uint32_t Value) {
+  constexpr uint32_t Mask = 0xFF;
+  Buffer[0] = static_cast<uint8_t>((Value & (Mask << 0)) >> 0);
+  Buffer[1] = static_cast<uint8_t>((Value & (Mask << 8)) >> 8);
+  Buffer[2] = static_cast<uint8_t>((Value & (Mask << 16)) >> 16);
+  Buffer[3] = static_cast<uint8_t>((Value & (Mask << 24)) >> 24);
+  return 4;
+}
+
 // Write 32-bit unsigned integer as 64-bit little endian.
+EZ_CLANG_RAMFUNC
 uint32_t writeUInt64(char *Buffer, uint32_t Value) {
   constexpr uint32_t Mask = 0xFF;
   Buffer[0] = static_cast<uint8_t>((Value & (Mask << 0)) >> 0);
@@ -19,6 +32,7 @@ uint32_t writeUInt64(char *Buffer, uint32_t Value) {
 }
 
 // Write 32-bit signed integer as 64-bit little endian.
+EZ_CLANG_RAMFUNC
 uint32_t writeSInt64(char Buffer[], int32_t Value) {
   constexpr uint32_t Mask = 0xFF;
   Buffer[0] = static_cast<uint8_t>((Value & (Mask << 0)) >> 0);
@@ -32,11 +46,13 @@ uint32_t writeSInt64(char Buffer[], int32_t Value) {
   return 8;
 }
 
+EZ_CLANG_RAMFUNC
 uint32_t writeBytes(char Buffer[], const void *Bytes, size_t Count) {
   memcpy(Buffer, Bytes, Count);
   return Count;
 }
 
+EZ_CLANG_RAMFUNC
 uint32_t writeString(char Buffer[], const char *Value) {
   uint32_t Chars = strlen(Value);
   uint32_t Written = writeUInt64(Buffer, Chars);
@@ -44,22 +60,26 @@ uint32_t writeString(char Buffer[], const char *Value) {
   return Written + Chars;
 }
 
+EZ_CLANG_RAMFUNC
 uint32_t writeBool(char Buffer[], bool Value) {
   Buffer[0] = (Value == true);
   return 1;
 }
 
+EZ_CLANG_RAMFUNC
 uint32_t readUInt8(const char Buffer[], uint8_t &Value) {
   Value = Buffer[0];
   return 1;
 }
 
+EZ_CLANG_RAMFUNC
 uint32_t readUInt16(const char Buffer[], uint16_t &Value) {
   Value = Buffer[0];
   Value |= static_cast<uint16_t>(Buffer[1]) << 8;
   return 2;
 }
 
+EZ_CLANG_RAMFUNC
 uint32_t readUInt32(const char Buffer[], uint32_t &Value) {
   Value = Buffer[0];
   Value |= static_cast<uint32_t>(Buffer[1]) << 8;
@@ -68,6 +88,7 @@ uint32_t readUInt32(const char Buffer[], uint32_t &Value) {
   return 4;
 }
 
+EZ_CLANG_RAMFUNC
 uint32_t readUInt64(const char Buffer[], uint64_t &Value) {
   Value = Buffer[0];
   Value |= static_cast<uint64_t>(Buffer[1]) << 8;
@@ -80,6 +101,7 @@ uint32_t readUInt64(const char Buffer[], uint64_t &Value) {
   return 8;
 }
 
+EZ_CLANG_RAMFUNC
 uint32_t readUInt64as32(const char Buffer[], uint32_t &Value) {
   Value = Buffer[0];
   Value |= static_cast<uint32_t>(Buffer[1]) << 8;
@@ -94,14 +116,30 @@ uint32_t readUInt64as32(const char Buffer[], uint32_t &Value) {
   return 8;
 }
 
+// Read 64-bit little endian as 32-bit signed integer.
+EZ_CLANG_RAMFUNC
+uint32_t readSInt64as32(const char Buffer[], int32_t &Value) {
+  uint32_t Bits;
+  readUInt32(Buffer, Bits);
+  Value = static_cast<int32_t>(Bits);
+  uint8_t Ext = Value < 0 ? 0xFF : 0;
+  for (int i = 4; i < 8; i += 1)
+    assert(static_cast<uint8_t>(Buffer[i]) == Ext,
+           "Out of bounds: expected 32-bit value");
+  return 8;
+}
+
+EZ_CLANG_RAMFUNC
 uint32_t readAddr(const char Buffer[], uint32_t &Value) {
   return readUInt64as32(Buffer, Value);
 }
 
+EZ_CLANG_RAMFUNC
 uint32_t readSize(const char Buffer[], uint32_t &Value) {
   return readUInt64as32(Buffer, Value);
 }
 
+EZ_CLANG_RAMFUNC
 uint32_t readString(const char Buffer[], char *const Value, uint32_t &Size) {
   uint32_t SizeLen = readSize(Buffer, Size);
   memcpy(Value, Buffer + SizeLen, Size);
@@ -0,0 +1,97 @@
+#include "ez/stats.h"
+
+#include "ez/protocol.h"
+#include "ez/support.h"
+
+#include <malloc.h>
+
+//
+// Boundaries of the stack and code buffer are provided from linker script
+//
+extern char _sstack;
+extern char _estack;
+extern char _scode_buffer;
+extern char _ecode_buffer;
+
+constexpr uint32_t StackPaint = 0xC5C5C5C5;
+
+static const char *CodeBufferHighWater = &_scode_buffer;
+static const char *MessageBufferHighWater = MessageBuffer;
+
+// Fill the unused part of the stack with a known pattern, so we can find the
+// deepest point it ever reached. Runs once at boot.
+__attribute__((noinline)) void statsPaintStack() {
+  // Leave a margin below our own frame
+  char *Limit = static_cast<char *>(__builtin_frame_address(0)) - 64;
+  if (Limit > &_estack)
+    Limit = &_estack;
+  uint32_t *Word = reinterpret_cast<uint32_t *>(align_ptr<4>(&_sstack));
+  while (reinterpret_cast<char *>(Word + 1) <= Limit)
+    *Word++ = StackPaint;
+}
+
+void statsTrackCodeBuffer(const char *End) {
+  if (End > CodeBufferHighWater && End <= &_ecode_buffer)
+    CodeBufferHighWater = End;
+}
+
+void statsTrackMessageBuffer(const char *End) {
+  if (End > MessageBufferHighWater && End <= MessageBuffer + sizeof(MessageBuffer))
+    MessageBufferHighWater = End;
+}
+
+static uint32_t stackHighWater() {
+  const uint32_t *Word = reinterpret_cast<const uint32_t *>(align_ptr<4>(&_sstack));
+  const uint32_t *End = reinterpret_cast<const uint32_t *>(&_estack);
+  while (Word < End && *Word == StackPaint)
+    Word += 1;
+  return &_estack - reinterpret_cast<const char *>(Word);
+}
+
+MemoryStats statsCollect() {
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+  struct mallinfo2 Heap = mallinfo2(); // Host build
+#else
+  struct mallinfo Heap = mallinfo();
+#endif
+  MemoryStats Stats;
+  Stats.StackSize = &_estack - &_sstack;
+  Stats.StackHighWater = stackHighWater();
+  Stats.CodeBufferSize = &_ecode_buffer - &_scode_buffer;
+  Stats.CodeBufferHighWater = CodeBufferHighWater - &_scode_buffer;
+  Stats.MessageBufferSize = sizeof(MessageBuffer);
+  Stats.MessageBufferHighWater = MessageBufferHighWater - MessageBuffer;
+  Stats.HeapArena = Heap.arena;
+  Stats.HeapInUse = Heap.uordblks;
+  return Stats;
+}
+
+static uint32_t Ticks = 0;
+static uint32_t MinTickCycles = UINT32_MAX;
+static uint32_t MaxTickCycles = 0;
+static uint64_t SumTickCycles = 0;
+
+void statsTrackTick(uint32_t Cycles) {
+  Ticks += 1;
+  SumTickCycles += Cycles;
+  if (Cycles < MinTickCycles)
+    MinTickCycles = Cycles;
+  if (Cycles > MaxTickCycles)
+    MaxTickCycles = Cycles;
+}
+
+void statsResetTicks() {
+  Ticks = 0;
+  MinTickCycles = UINT32_MAX;
+  MaxTickCycles = 0;
+  SumTickCycles = 0;
+}
+
+TickStats statsCollectTicks() {
+  TickStats Stats;
+  Stats.Ticks = Ticks;
+  Stats.MinCycles = Ticks > 0 ? MinTickCycles : 0;
+  Stats.MaxCycles = MaxTickCycles;
+  Stats.MeanCycles = Ticks > 0 ? static_cast<uint32_t>(SumTickCycles / Ticks) : 0;
+  return Stats;
+}
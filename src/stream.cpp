@@ -0,0 +1,221 @@
+#include "ez/stream.h"
+
+#include "ez/abi.h"
+
+#include "ez/assert.h"
+#include "ez/device.h"
+#include "ez/protocol.h"
+#include "ez/response.h"
+#include "ez/serialize.h"
+#include "ez/support.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+//
+// Streaming telemetry: JIT code appends fixed-size binary records to a ring
+// buffer with __ez_clang_stream_write() and the message loop sends them to the
+// host in chunks, one StreamData message per chunk. Payload of StreamData:
+// record size, index of the first record in the chunk, total number of
+// dropped records, followed by the raw records.
+//
+// The ring has a single producer and a single consumer. The producer can be
+// JIT code in the message loop context or a scheduled function in interrupt
+// context and it never blocks: if the ring is full, the record is dropped and
+// counted. The consumer is the message loop, which drains while it's idle and
+// whenever JIT code calls __ez_clang_yield(). Sending blocks while the link is
+// busy, so a slow link fills the ring and that's where we apply backpressure.
+// A partial chunk is sent once its oldest record waited for longer than
+// EZ_CLANG_STREAM_FLUSH_MILLIS, so low-rate streams don't stall.
+//
+// Head and Tail are free-running record counters. Each of them is written by
+// one side only. Reconfigure only while no producer is active.
+//
+
+#ifndef EZ_CLANG_STREAM_BUFFER_SIZE
+#define EZ_CLANG_STREAM_BUFFER_SIZE 1024
+#endif
+
+#ifndef EZ_CLANG_STREAM_FLUSH_MILLIS
+#define EZ_CLANG_STREAM_FLUSH_MILLIS 50
+#endif
+
+static char StreamBuffer[EZ_CLANG_STREAM_BUFFER_SIZE] __attribute__((aligned(4)));
+
+static uint32_t RecordSize = 0; // 0 if inactive
+static uint32_t Capacity = 0;   // In records
+static uint32_t ChunkRecords = 0;
+
+// Producer side
+static volatile uint32_t Head = 0;
+static uint32_t HeadIndex = 0;
+static volatile uint32_t Dropped = 0;
+static volatile uint32_t MaxFill = 0;
+
+// Consumer side
+static volatile uint32_t Tail = 0;
+static uint32_t TailIndex = 0;
+static uint32_t Chunks = 0;
+static bool Waiting = false; // Records pending since WaitBegin
+static uint32_t WaitBegin = 0;
+
+// Stores to the ring must not be reordered with the index update that
+// publishes them. Cortex-M is single-core, so a compiler barrier is enough.
+static inline void publishBarrier() {
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+static void sendChunk(uint32_t NumRecords) {
+  char Header[3 * 8];
+  char *Data = Header;
+  Data += writeUInt64(Data, RecordSize);
+  Data += writeUInt64(Data, Tail);
+  Data += writeUInt64(Data, Dropped);
+
+  // Records might wrap around the end of the ring
+  uint32_t UntilWrap = Capacity - TailIndex;
+  uint32_t First = NumRecords < UntilWrap ? NumRecords : UntilWrap;
+  IOVec Parts[] {
+    { Header, sizeof(Header) },
+    { StreamBuffer + TailIndex * RecordSize, First * RecordSize },
+    { StreamBuffer, (NumRecords - First) * RecordSize },
+  };
+  // Not retransmittable: with frame CRCs, the device ignores Naks for lost
+  // chunks and the host detects the gap from the record index.
+  constexpr uint32_t NoSequenceNumber = 0;
+  sendMessagev(StreamData, NoSequenceNumber, Parts, c_array_size(Parts));
+
+  TailIndex += NumRecords;
+  if (TailIndex >= Capacity)
+    TailIndex -= Capacity;
+  publishBarrier();
+  Tail = Tail + NumRecords;
+  Chunks += 1;
+}
+
+// Whether the oldest pending record is due for sending in a partial chunk.
+// We see it only when we poll, so the age is measured from the first poll.
+static bool partialChunkExpired() {
+  uint32_t Now = device_readCycleCounter();
+  if (!Waiting) {
+    Waiting = true;
+    WaitBegin = Now;
+    return false;
+  }
+  uint32_t Timeout =
+      device_getCycleCounterFrequency() / 1000 * EZ_CLANG_STREAM_FLUSH_MILLIS;
+  return Now - WaitBegin > Timeout;
+}
+
+void streamDrain(bool Flush) {
+  if (RecordSize == 0)
+    return;
+  while (true) {
+    uint32_t Pending = Head - Tail;
+    if (Pending == 0) {
+      Waiting = false;
+      return;
+    }
+    if (Pending < ChunkRecords && !Flush && !partialChunkExpired())
+      return;
+    sendChunk(Pending < ChunkRecords ? Pending : ChunkRecords);
+    Waiting = false;
+  }
+}
+
+bool streamIsActive() { return RecordSize != 0; }
+
+void streamReset() {
+  RecordSize = 0;
+  Capacity = 0;
+  ChunkRecords = 0;
+  Head = 0;
+  HeadIndex = 0;
+  Dropped = 0;
+  MaxFill = 0;
+  Tail = 0;
+  TailIndex = 0;
+  Chunks = 0;
+  Waiting = false;
+  WaitBegin = 0;
+}
+
+extern "C" {
+
+// Append one record to the stream. Safe to call from interrupt handlers.
+// Returns 0 if the stream is inactive or the record was dropped.
+uint32_t __ez_clang_stream_write(const void *Record) {
+  if (RecordSize == 0)
+    return 0;
+  uint32_t H = Head;
+  uint32_t Fill = H - Tail;
+  if (Fill >= Capacity) {
+    Dropped = Dropped + 1;
+    return 0;
+  }
+  memcpy(StreamBuffer + HeadIndex * RecordSize, Record, RecordSize);
+  HeadIndex = HeadIndex + 1 == Capacity ? 0 : HeadIndex + 1;
+  publishBarrier();
+  Head = H + 1;
+  if (Fill + 1 > MaxFill)
+    MaxFill = Fill + 1;
+  return 1;
+}
+
+// Number of records that can be written without dropping. Producers can use
+// it to throttle themselves.
+uint32_t __ez_clang_stream_space() {
+  return RecordSize == 0 ? 0 : Capacity - (Head - Tail);
+}
+
+// Start, reconfigure or stop streaming. Pending records are flushed first.
+// Input: record size (0 to stop), records per chunk (0 for half the ring).
+// Output: HasError, capacity in records, records per chunk.
+char *__ez_clang_rpc_stream_configure(const char *Data, size_t Size) {
+  assert(Size == 16, "Invalid input length");
+
+  uint32_t NewRecordSize;
+  uint32_t NewChunkRecords;
+  Data += readSize(Data, NewRecordSize);
+  Data += readSize(Data, NewChunkRecords);
+
+  constexpr uint32_t MaxRecordSize = EZ_CLANG_STREAM_BUFFER_SIZE / 2;
+  if (NewRecordSize > MaxRecordSize)
+    return error(ErrStreamRecordSize, NewRecordSize, MaxRecordSize);
+
+  streamDrain(true);
+  streamReset();
+  if (NewRecordSize > 0) {
+    Capacity = EZ_CLANG_STREAM_BUFFER_SIZE / NewRecordSize;
+    if (NewChunkRecords == 0)
+      NewChunkRecords = Capacity / 2;
+    ChunkRecords = NewChunkRecords < Capacity ? NewChunkRecords : Capacity;
+    RecordSize = NewRecordSize;
+  }
+
+  char *Resp = responseAcquire(1 + 8 + 8);
+  Resp += writeBool(Resp, false); // HasError
+  Resp += writeUInt64(Resp, Capacity);
+  Resp += writeUInt64(Resp, ChunkRecords);
+  return responseFinalize(Resp);
+}
+
+// Output: HasError, record size, capacity, records written, records sent,
+// records dropped, chunks sent, maximum fill level in records.
+char *__ez_clang_rpc_stream_stats(const char *Data, size_t Size) {
+  assert(Size == 0, "Invalid input length");
+
+  char *Resp = responseAcquire(1 + 7 * 8);
+  Resp += writeBool(Resp, false); // HasError
+  Resp += writeUInt64(Resp, RecordSize);
+  Resp += writeUInt64(Resp, Capacity);
+  Resp += writeUInt64(Resp, Head);
+  Resp += writeUInt64(Resp, Tail);
+  Resp += writeUInt64(Resp, Dropped);
+  Resp += writeUInt64(Resp, Chunks);
+  Resp += writeUInt64(Resp, MaxFill);
+  return responseFinalize(Resp);
+}
+
+} // extern "C"
@@ -2,6 +2,7 @@
 
 #include "ez/abi.h"
 #include "ez/assert.h"
+#include "ez/jumptable.h"
 #include "ez/support.h"
 
 #include <cstring>
@@ -24,26 +25,88 @@ extern const char _estrtab;
 static const Symbol BuiltinRPCEndpoints[] {
   X(__ez_clang_rpc_commit),
   X(__ez_clang_rpc_execute),
+  X(__ez_clang_rpc_call),
+  X(__ez_clang_rpc_benchmark),
+  X(__ez_clang_rpc_memory_stats),
+  X(__ez_clang_rpc_tick_stats),
+  X(__ez_clang_rpc_load_relocatable),
+  X(__ez_clang_rpc_execute_async),
+  X(__ez_clang_rpc_execute_status),
+  X(__ez_clang_rpc_execute_cancel),
+  X(__ez_clang_rpc_schedule_start),
+  X(__ez_clang_rpc_schedule_stop),
+  X(__ez_clang_rpc_schedule_stats),
+  X(__ez_clang_rpc_stream_configure),
+  X(__ez_clang_rpc_stream_stats),
+  X(__ez_clang_rpc_irq_attach),
+  X(__ez_clang_rpc_irq_detach),
+  X(__ez_clang_rpc_trampoline_info),
+  X(__ez_clang_rpc_trampoline_retarget),
+  X(__ez_clang_rpc_mem_read),
   X(__ez_clang_rpc_mem_read_cstring),
+  X(__ez_clang_rpc_fault_info),
+  X(__ez_clang_rpc_lookup_slots),
+  X(__ez_clang_rpc_jumptable_info),
+#ifdef EZ_CLANG_DSP_BENCH
+  X(__ez_clang_rpc_dsp_bench),
+#endif
 };
 
 static const Symbol BuiltinRuntimeFunctions[] {
   X(__ez_clang_report_value),
+  X(__ez_clang_stream_write),
+  X(__ez_clang_stream_space),
   X(__ez_clang_report_string),
-  X(__ez_clang_inline_heap_acquire)
+  X(__ez_clang_inline_heap_acquire),
+  X(__ez_clang_crc32),
+  X(__ez_clang_yield),
+#ifdef EZ_CLANG_DSP_BENCH
+  X(__ez_clang_dsp_bench_signal),
+  X(__ez_clang_dsp_bench_coeffs),
+  X(__ez_clang_dsp_bench_output),
+  X(__ez_clang_dsp_bench_mat_a),
+  X(__ez_clang_dsp_bench_mat_b),
+  X(__ez_clang_dsp_bench_mat_c),
+  X(__ez_clang_dsp_bench_fft),
+#endif
 };
 
 uint32_t getBootstrapSymbols(const Symbol *BootstrapSyms[]) {
-  static const Symbol BootstrapSym = X(__ez_clang_rpc_lookup);
-  *BootstrapSyms = &BootstrapSym;
-  return 1;
+  static const Symbol BootstrapSymbols[] {
+    X(__ez_clang_rpc_lookup),
+#ifdef EZ_CLANG_FRAME_CRC
+    // Presence tells the host that frames carry a CRC-32 trailer
+    X(__ez_clang_crc32),
+#endif
+#if defined(__arm__) && defined(__thumb__)
+    // Presence tells the host that it can bind calls lazily
+    X(__ez_clang_lazy_trampoline),
+#endif
+  };
+  *BootstrapSyms = BootstrapSymbols;
+  return c_array_size(BootstrapSymbols);
+}
+
+// Compare a size-prefixed name from a request with a NUL-terminated symbol
+// name. Order is the same as strcmp, so a prefix sorts before the full name
+// and doesn't match it.
+EZ_CLANG_RAMFUNC
+static int compareSymbolName(const char *Data, uint32_t Length,
+                             const char *Name) {
+  for (uint32_t i = 0; i < Length; i += 1) {
+    uint8_t A = Data[i];
+    uint8_t B = Name[i];
+    if (A != B)
+      return A < B ? -1 : 1;
+  }
+  return Name[Length] == '\0' ? 0 : -1;
 }
 
 template <size_t Size>
 uint32_t lookupUnordered(const Symbol (&Array)[Size], const char *Data,
                          uint32_t Length) {
   for (uint32_t i = 0; i < Size; i += 1)
-    if (memcmp(Array[i].Name, Data, Length) == 0)
+    if (compareSymbolName(Data, Length, Array[i].Name) == 0)
       return Array[i].Addr;
   return 0;
 }
@@ -66,20 +129,32 @@ uint32_t lookupBuiltinSymbol(const char *Data, uint32_t Length) {
   return SymbolNotFound;
 }
 
-uint32_t lookupSymbol(const char *Data, uint32_t Length) {
+static const EzClang_Sym *findSymbol(const char *Data, uint32_t Length) {
   const EzClang_Sym *First = &_ssymtab;
   const EzClang_Sym *Last = &_esymtab - 1;
   while (First <= Last) {
     const EzClang_Sym *It = First + ((Last - First) / 2);
     const char *Str = &_sstrtab + It->st_name;
-    int Cmp = memcmp(Data, Str, Length);
+    int Cmp = compareSymbolName(Data, Length, Str);
     if (Cmp > 0) {
       First = It + 1;
     } else if (Cmp < 0) {
       Last = It - 1;
     } else {
-      return It->st_value;
+      return It;
     }
   }
-  return 0;
+  return nullptr;
+}
+
+uint32_t lookupSymbol(const char *Data, uint32_t Length) {
+  if (const EzClang_Sym *Sym = findSymbol(Data, Length))
+    return Sym->st_value;
+  return SymbolNotFound;
+}
+
+uint32_t lookupSymbolSlot(const char *Data, uint32_t Length) {
+  if (const EzClang_Sym *Sym = findSymbol(Data, Length))
+    return jumptableLookup(Sym - &_ssymtab, Sym->st_value);
+  return SymbolNotFound;
 }
@@ -0,0 +1,103 @@
+#include "ez/trampoline.h"
+
+#include "ez/abi.h"
+
+#include "ez/assert.h"
+#include "ez/response.h"
+#include "ez/serialize.h"
+#include "ez/support.h"
+#include "ez/veneer.h"
+
+#include <csetjmp>
+#include <cstddef>
+#include <cstdint>
+
+//
+// Hot-reload: The host can route calls to a function through a trampoline in
+// a device-managed table. When the function is redefined, the host commits
+// only the new body and retargets the trampoline. Callers stay untouched.
+//
+// Trampolines are veneers (see ez/veneer.h) in RAM. Retargeting is a single
+// aligned word store, so a concurrent call (e.g. from an interrupt handler)
+// goes either to the old or to the new body. Slots that were never bound
+// report an error with the Hangup message.
+//
+
+#ifndef EZ_CLANG_NUM_TRAMPOLINES
+#define EZ_CLANG_NUM_TRAMPOLINES 32
+#endif
+
+struct Trampoline {
+  uint16_t Code[4];
+  volatile uint32_t Target;
+};
+
+static_assert(sizeof(Trampoline) == VeneerSize &&
+                  offsetof(Trampoline, Target) == VeneerTargetOffset,
+              "Trampoline layout mismatch");
+
+static Trampoline Trampolines[EZ_CLANG_NUM_TRAMPOLINES] __attribute__((aligned(4)));
+
+static void trampolineUnbound() {
+  // We are in the middle of executing JITed code and can't return to it
+  errorEx(GlobalAssertionFailureBuffer, GlobalAssertionFailureBufferSize,
+          ErrTrampolineUnbound, nullptr, 0);
+  longjmp(GlobalAssertionFailureReturnPoint, 1);
+}
+
+void trampolineReset() {
+  for (Trampoline &T : Trampolines)
+    writeVeneer(reinterpret_cast<char *>(&T), ptr2addr(&trampolineUnbound));
+}
+
+extern "C" {
+
+// Output: HasError, table address, size of one trampoline, number of them
+char *__ez_clang_rpc_trampoline_info(const char *Data, size_t Size) {
+  assert(Size == 0, "Invalid input length");
+#if !defined(__arm__) || !defined(__thumb__)
+  return error(ErrTrampolineUnsupported);
+#else
+  char *Resp = responseAcquire(1 + 3 * 8);
+  Resp += writeBool(Resp, false); // HasError
+  Resp += writeUInt64(Resp, ptr2addr(Trampolines));
+  Resp += writeUInt64(Resp, sizeof(Trampoline));
+  Resp += writeUInt64(Resp, EZ_CLANG_NUM_TRAMPOLINES);
+  return responseFinalize(Resp);
+#endif
+}
+
+// Point a trampoline to a committed function. Input: slot, function address.
+// Output: HasError, trampoline address (Thumb), previous target (0 if the
+// slot was unbound).
+char *__ez_clang_rpc_trampoline_retarget(const char *Data, size_t Size) {
+  assert(Size == 16, "Invalid input length");
+
+  uint32_t Slot;
+  uint32_t FnAddr;
+  Data += readSize(Data, Slot);
+  Data += readAddr(Data, FnAddr);
+
+#if !defined(__arm__) || !defined(__thumb__)
+  return error(ErrTrampolineUnsupported);
+#else
+  if (Slot >= EZ_CLANG_NUM_TRAMPOLINES)
+    return error(ErrTrampolineSlot, Slot, EZ_CLANG_NUM_TRAMPOLINES);
+  if (!isThumbFunction(FnAddr))
+    return error(ErrNonThumbFunction, FnAddr);
+
+  Trampoline &T = Trampolines[Slot];
+  uint32_t Previous = T.Target;
+  if (Previous == (ptr2addr(&trampolineUnbound) | 1))
+    Previous = 0;
+  T.Target = FnAddr;
+
+  char *Resp = responseAcquire(1 + 2 * 8);
+  Resp += writeBool(Resp, false); // HasError
+  Resp += writeUInt64(Resp, ptr2addr(&T) | 1);
+  Resp += writeUInt64(Resp, Previous);
+  return responseFinalize(Resp);
+#endif
+}
+
+} // extern "C"
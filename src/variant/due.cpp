@@ -1,34 +1,191 @@
 #include "ez/device.h"
 
 #include "ez/assert.h"
+#include "ez/protocol.h"
 #include "ez/response.h"
 #include "ez/support.h"
+#include "ez/transport.h"
 
 #include "Arduino.h"
 
+// Uses CMSIS definitions from the Arduino core
+#include "ez/vectors.h"
+
+// Due has two ports: the programming port is a hardware UART that goes through
+// the on-board USB bridge, the native port is USB CDC on the SAM3X itself
+#ifdef EZ_CLANG_TRANSPORT_NATIVE_USB
+using Transport = UsbCdcTransport<decltype(SerialUSB), SerialUSB>;
+#else
+using Transport = UartTransport<decltype(Serial), Serial, 9600>;
+#endif
+
 void device_setupSendReceive() {
-  // CDC serial channel @ 9600 baud
-  Serial.begin(9600);
+  Transport::begin();
 
+#ifdef EZ_CLANG_TRANSPORT_NATIVE_USB
+  // Opening the native port doesn't reset the board. Wait for the REPL (or the
+  // test driver) to send the handshake sequence to start the session.
+  waitForHandshake();
+#else
   // Discard any existing data (host will connect and send data only after
   // receiving the setup message)
   device_flushReceiveBuffer();
+#endif
 }
 
 bool device_receiveBytes(char Buffer[], uint32_t Count) {
-  uint32_t Received = 0;
-  while (Received < Count) {
-    Received += Serial.readBytes(Buffer + Received, Count - Received);
-  }
-  return true;
+  return Transport::receiveBytes(Buffer, Count);
+}
+
+uint32_t device_receiveBytesPartial(char Buffer[], uint32_t Count) {
+  return Transport::receiveBytesPartial(Buffer, Count);
+}
+
+bool device_receiveReady() {
+  return Transport::receiveReady();
 }
 
 void device_sendBytes(const char *Buffer, size_t Size) {
-  Serial.write(Buffer, Size);
+  Transport::sendBytes(Buffer, Size);
+}
+
+void device_sendv(const IOVec Vec[], uint32_t Count) {
+  Transport::sendv(Vec, Count);
 }
 
 void device_flushReceiveBuffer() {
-  Serial.flush();
+  Transport::flushReceiveBuffer();
+}
+
+//
+// Memory regions: code in sram0, data in sram1 next to the stack. The linker
+// script splits the code buffer at the bank boundary.
+//
+extern char _scode_region;
+extern char _ecode_region;
+extern char _sdata_region;
+extern char _edata_region;
+extern char _sstack;
+extern char _estack;
+
+static const MemoryRegion Regions[] {
+  { RegionCode, 0, RegionExec | RegionWrite, &_scode_region, &_ecode_region },
+  { RegionData, 1, RegionExec | RegionWrite, &_sdata_region, &_edata_region },
+  { RegionStack, 1, RegionWrite, &_sstack, &_estack },
+};
+
+uint32_t device_getMemoryRegions(const MemoryRegion *R[]) {
+  *R = Regions;
+  return c_array_size(Regions);
+}
+
+void device_setupCycleCounter() {
+  // Enable the DWT cycle counter (free-running at core clock)
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t device_readCycleCounter() {
+  return DWT->CYCCNT;
+}
+
+uint32_t device_getCycleCounterFrequency() {
+  return F_CPU;
+}
+
+uint32_t device_readMillis() {
+  return millis();
+}
+
+// DWT->CYCCNT is 32-bit, i.e. ~51s at 84MHz
+uint32_t device_getCycleCounterRangeMillis() {
+  return UINT32_MAX / (F_CPU / 1000);
+}
+
+//
+// Periodic timer: TC1 channel 0 (TC3 interrupt) at MCK/2
+//
+static void (*PeriodicTimerHandler)() = nullptr;
+
+bool device_startPeriodicTimer(uint32_t PeriodMicros, void (*Handler)()) {
+  device_stopPeriodicTimer();
+  PeriodicTimerHandler = Handler;
+  pmc_set_writeprotect(false);
+  pmc_enable_periph_clk(ID_TC3);
+  TC_Configure(TC1, 0, TC_CMR_WAVE | TC_CMR_WAVSEL_UP_RC |
+                       TC_CMR_TCCLKS_TIMER_CLOCK1);
+  TC_SetRC(TC1, 0, VARIANT_MCK / 2 / 1000000 * PeriodMicros);
+  TC1->TC_CHANNEL[0].TC_IER = TC_IER_CPCS;
+  TC1->TC_CHANNEL[0].TC_IDR = ~TC_IER_CPCS;
+
+  // Lowest priority, so the serial port keeps working
+  NVIC_SetPriority(TC3_IRQn, 15);
+  NVIC_ClearPendingIRQ(TC3_IRQn);
+  NVIC_EnableIRQ(TC3_IRQn);
+  TC_Start(TC1, 0);
+  return true;
+}
+
+void device_stopPeriodicTimer() {
+  NVIC_DisableIRQ(TC3_IRQn);
+  TC_Stop(TC1, 0);
+  PeriodicTimerHandler = nullptr;
+}
+
+uint32_t device_getMaxTimerPeriodMicros() {
+  // The RC compare register has 32 bits
+  return UINT32_MAX / (VARIANT_MCK / 2 / 1000000);
+}
+
+void device_pausePeriodicTimer() {
+  NVIC_DisableIRQ(TC3_IRQn);
+}
+
+void device_resumePeriodicTimer() {
+  if (PeriodicTimerHandler)
+    NVIC_EnableIRQ(TC3_IRQn);
+}
+
+extern "C" void TC3_Handler() {
+  TC_GetStatus(TC1, 0);
+  if (PeriodicTimerHandler)
+    PeriodicTimerHandler();
+}
+
+//
+// Faults in JIT code don't reboot the device (see fault.cpp)
+//
+extern "C" __attribute__((naked)) void HardFault_Handler() {
+  asm volatile("ldr r0, =__ez_clang_fault_entry\n"
+               "bx r0\n"
+               ".ltorg\n");
+}
+
+//
+// Interrupt handlers from JIT code in a vector table in SRAM
+//
+using Vectors = RamVectorTable<PERIPH_COUNT_IRQn>;
+
+uint32_t device_getNumInterrupts() {
+  return PERIPH_COUNT_IRQn;
+}
+
+uint32_t device_getNumInterruptPriorities() {
+  return 1u << __NVIC_PRIO_BITS;
+}
+
+bool device_isReservedInterrupt(uint32_t Irq) {
+  // Transport on either port and periodic timer
+  return Irq == UART_IRQn || Irq == UOTGHS_IRQn || Irq == TC3_IRQn;
+}
+
+void device_attachInterrupt(uint32_t Irq, uint32_t Priority, void (*Handler)()) {
+  Vectors::attach(Irq, Priority, Handler);
+}
+
+void device_detachInterrupt(uint32_t Irq) {
+  Vectors::detach(Irq);
 }
 
 void device_notifyBoot() {
@@ -0,0 +1,164 @@
+#include "ez/device.h"
+
+#include "ez/protocol.h"
+#include "ez/support.h"
+#include "ez/transport.h"
+
+#include <cstdint>
+#include <ctime>
+
+#include <unistd.h>
+
+// The firmware runs as a regular process and talks to the host tools through
+// stdin/stdout. Addresses are passed as 32-bit values, so this must be built
+// without PIE (see [env:native]), which keeps code and static data in the
+// lower 4GB. JITed code can't be executed, but the protocol path can be
+// benchmarked and debugged without a board. Set EZ_CLANG_LINK to emulate the
+// wire of a board (see EmulatedTransport).
+using Transport = EmulatedTransport<FdTransport<STDIN_FILENO, STDOUT_FILENO>>;
+
+//
+// Memory regions that the device linker scripts provide. The symbol and string
+// tables and the jump table are empty: there are no exported symbols beyond the
+// builtins. The process stack isn't tracked.
+//
+extern "C" {
+char HostCodeBuffer[0x8000] __attribute__((aligned(0x100)));
+char HostEmptyTable[16] __attribute__((aligned(4)));
+}
+
+asm(".globl _scode_buffer\n"
+    ".set _scode_buffer, HostCodeBuffer\n"
+    ".globl _ecode_buffer\n"
+    ".set _ecode_buffer, HostCodeBuffer + 0x8000\n"
+    ".globl _ssymtab\n"
+    ".set _ssymtab, HostEmptyTable\n"
+    ".globl _esymtab\n"
+    ".set _esymtab, HostEmptyTable\n"
+    ".globl _sstrtab\n"
+    ".set _sstrtab, HostEmptyTable\n"
+    ".globl _estrtab\n"
+    ".set _estrtab, HostEmptyTable\n"
+    ".globl _sslots\n"
+    ".set _sslots, HostEmptyTable\n"
+    ".globl _eslots\n"
+    ".set _eslots, HostEmptyTable + 12\n"
+    ".globl _sjumptable\n"
+    ".set _sjumptable, HostEmptyTable\n"
+    ".globl _sstack\n"
+    ".set _sstack, HostEmptyTable\n"
+    ".globl _estack\n"
+    ".set _estack, HostEmptyTable\n");
+
+void device_setupSendReceive() {
+  Transport::begin();
+
+  // Wait for the host tool to send the handshake sequence to start the session
+  waitForHandshake();
+}
+
+bool device_receiveBytes(char Buffer[], uint32_t Count) {
+  return Transport::receiveBytes(Buffer, Count);
+}
+
+uint32_t device_receiveBytesPartial(char Buffer[], uint32_t Count) {
+  return Transport::receiveBytesPartial(Buffer, Count);
+}
+
+bool device_receiveReady() {
+  return Transport::receiveReady();
+}
+
+void device_sendBytes(const char *Buffer, size_t Size) {
+  Transport::sendBytes(Buffer, Size);
+}
+
+void device_sendv(const IOVec Vec[], uint32_t Count) {
+  Transport::sendv(Vec, Count);
+}
+
+void device_flushReceiveBuffer() {
+  Transport::flushReceiveBuffer();
+}
+
+// The code buffer is a static array in the process
+extern "C" char _scode_buffer;
+extern "C" char _ecode_buffer;
+
+static const MemoryRegion Regions[] {
+  { RegionCode, 0, RegionExec | RegionWrite, &_scode_buffer, &_ecode_buffer },
+};
+
+uint32_t device_getMemoryRegions(const MemoryRegion *R[]) {
+  *R = Regions;
+  return c_array_size(Regions);
+}
+
+void device_setupCycleCounter() {}
+
+// Monotonic clock in nanoseconds, wraps every ~4.3s like a fast cycle counter
+uint32_t device_readCycleCounter() {
+  timespec Now;
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  return static_cast<uint32_t>(Now.tv_sec * 1000000000ull + Now.tv_nsec);
+}
+
+uint32_t device_getCycleCounterFrequency() {
+  return 1000000000;
+}
+
+uint32_t device_readMillis() {
+  timespec Now;
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  return static_cast<uint32_t>(Now.tv_sec * 1000ull + Now.tv_nsec / 1000000);
+}
+
+uint32_t device_getCycleCounterRangeMillis() {
+  return UINT32_MAX / 1000000;
+}
+
+bool device_startPeriodicTimer(uint32_t PeriodMicros, void (*Handler)()) {
+  return false;
+}
+
+void device_stopPeriodicTimer() {}
+
+uint32_t device_getMaxTimerPeriodMicros() {
+  return 0;
+}
+
+void device_pausePeriodicTimer() {}
+void device_resumePeriodicTimer() {}
+
+// No interrupts in the host process
+uint32_t device_getNumInterrupts() {
+  return 0;
+}
+
+uint32_t device_getNumInterruptPriorities() {
+  return 0;
+}
+
+bool device_isReservedInterrupt(uint32_t Irq) {
+  return false;
+}
+
+void device_attachInterrupt(uint32_t Irq, uint32_t Priority, void (*Handler)()) {}
+void device_detachInterrupt(uint32_t Irq) {}
+
+void device_notifyBoot() {}
+void device_notifyReady() {}
+void device_notifyTick() {}
+void device_notifyShutdown() {}
+
+//
+// There is no Arduino core that calls these for us
+//
+extern "C" void setup();
+extern "C" void loop();
+
+int main() {
+  setup();
+  while (true)
+    loop();
+}
@@ -4,12 +4,17 @@
 #include "ez/protocol.h"
 #include "ez/response.h"
 #include "ez/support.h"
+#include "ez/transport.h"
 
 #include "Arduino.h"
 
+// Uses CMSIS definitions from the Arduino core
+#include "ez/vectors.h"
+
+using Transport = UsbCdcTransport<decltype(Serial), Serial>;
+
 void device_setupSendReceive() {
-  // CDC serial channel @ 9600 baud
-  Serial.begin(9600);
+  Transport::begin();
 
   // Wait for the REPL (or the test driver) to send the handshake sequence to
   // start the session
@@ -17,19 +22,186 @@ void device_setupSendReceive() {
 }
 
 bool device_receiveBytes(char Buffer[], uint32_t Count) {
-  uint32_t Received = 0;
-  while (Received < Count) {
-    Received += Serial.readBytes(Buffer + Received, Count - Received);
-  }
-  return true;
+  return Transport::receiveBytes(Buffer, Count);
+}
+
+uint32_t device_receiveBytesPartial(char Buffer[], uint32_t Count) {
+  return Transport::receiveBytesPartial(Buffer, Count);
+}
+
+bool device_receiveReady() {
+  return Transport::receiveReady();
 }
 
 void device_sendBytes(const char *Buffer, size_t Size) {
-  Serial.write(Buffer, Size);
+  Transport::sendBytes(Buffer, Size);
+}
+
+void device_sendv(const IOVec Vec[], uint32_t Count) {
+  Transport::sendv(Vec, Count);
 }
 
 void device_flushReceiveBuffer() {
-  Serial.flush();
+  Transport::flushReceiveBuffer();
+}
+
+//
+// Memory regions: a single SRAM bank, so the entire code buffer is one region
+//
+extern char _scode_buffer;
+extern char _ecode_buffer;
+extern char _sstack;
+extern char _estack;
+
+static const MemoryRegion Regions[] {
+  { RegionCode, 0, RegionExec | RegionWrite, &_scode_buffer, &_ecode_buffer },
+  { RegionStack, 0, RegionWrite, &_sstack, &_estack },
+};
+
+uint32_t device_getMemoryRegions(const MemoryRegion *R[]) {
+  *R = Regions;
+  return c_array_size(Regions);
+}
+
+void device_setupCycleCounter() {
+  // No DWT on Cortex-M0+, we use SysTick as configured by the Arduino core
+}
+
+uint32_t device_readCycleCounter() {
+  // Extend the down-counting SysTick value with the millisecond tick count.
+  // Retry if the SysTick interrupt advanced the tick count in between.
+  uint32_t Reload = SysTick->LOAD + 1;
+  uint32_t Ticks;
+  uint32_t Value;
+  do {
+    Ticks = millis();
+    Value = SysTick->VAL;
+  } while (Ticks != millis());
+  return Ticks * Reload + (Reload - 1 - Value);
+}
+
+uint32_t device_getCycleCounterFrequency() {
+  return F_CPU;
+}
+
+uint32_t device_readMillis() {
+  return millis();
+}
+
+// The extended count is 32-bit, i.e. ~89s at 48MHz
+uint32_t device_getCycleCounterRangeMillis() {
+  return UINT32_MAX / (F_CPU / 1000);
+}
+
+//
+// Periodic timer: TC3 in 16-bit match-frequency mode on GCLK0
+//
+static void (*PeriodicTimerHandler)() = nullptr;
+
+static void syncTC3() {
+  while (TC3->COUNT16.STATUS.bit.SYNCBUSY)
+    ;
+}
+
+// Available prescalers of the 16-bit counter
+static const uint16_t Prescalers[] = {1, 2, 4, 8, 16, 64, 256, 1024};
+
+bool device_startPeriodicTimer(uint32_t PeriodMicros, void (*Handler)()) {
+  device_stopPeriodicTimer();
+
+  // Pick the smallest prescaler that fits the period into 16 bits
+  uint32_t TicksPerMicro = F_CPU / 1000000;
+  uint32_t Index = 0;
+  uint32_t Count = TicksPerMicro * PeriodMicros;
+  while (Count > 0x10000) {
+    Index += 1;
+    if (Index == c_array_size(Prescalers))
+      return false;
+    Count = TicksPerMicro * PeriodMicros / Prescalers[Index];
+  }
+
+  PeriodicTimerHandler = Handler;
+  GCLK->CLKCTRL.reg = GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK0 |
+                      GCLK_CLKCTRL_ID_TCC2_TC3;
+  while (GCLK->STATUS.bit.SYNCBUSY)
+    ;
+  TC3->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 | TC_CTRLA_WAVEGEN_MFRQ |
+                           TC_CTRLA_PRESCALER(Index);
+  syncTC3();
+  TC3->COUNT16.CC[0].reg = Count - 1;
+  syncTC3();
+  TC3->COUNT16.INTENSET.reg = TC_INTENSET_MC0;
+
+  // Lowest priority, so USB keeps working
+  NVIC_SetPriority(TC3_IRQn, 3);
+  NVIC_ClearPendingIRQ(TC3_IRQn);
+  NVIC_EnableIRQ(TC3_IRQn);
+  TC3->COUNT16.CTRLA.reg |= TC_CTRLA_ENABLE;
+  syncTC3();
+  return true;
+}
+
+void device_stopPeriodicTimer() {
+  NVIC_DisableIRQ(TC3_IRQn);
+  TC3->COUNT16.CTRLA.reg &= ~TC_CTRLA_ENABLE;
+  syncTC3();
+  PeriodicTimerHandler = nullptr;
+}
+
+uint32_t device_getMaxTimerPeriodMicros() {
+  // About 1.4s at 48MHz
+  uint32_t MaxPrescaler = Prescalers[c_array_size(Prescalers) - 1];
+  return 0x10000 * MaxPrescaler / (F_CPU / 1000000);
+}
+
+void device_pausePeriodicTimer() {
+  NVIC_DisableIRQ(TC3_IRQn);
+}
+
+void device_resumePeriodicTimer() {
+  if (PeriodicTimerHandler)
+    NVIC_EnableIRQ(TC3_IRQn);
+}
+
+extern "C" void TC3_Handler() {
+  TC3->COUNT16.INTFLAG.reg = TC_INTFLAG_MC0;
+  if (PeriodicTimerHandler)
+    PeriodicTimerHandler();
+}
+
+//
+// Faults in JIT code don't reboot the device (see fault.cpp)
+//
+extern "C" __attribute__((naked)) void HardFault_Handler() {
+  asm volatile("ldr r0, =__ez_clang_fault_entry\n"
+               "bx r0\n"
+               ".ltorg\n");
+}
+
+//
+// Interrupt handlers from JIT code in a vector table in SRAM
+//
+using Vectors = RamVectorTable<PERIPH_COUNT_IRQn>;
+
+uint32_t device_getNumInterrupts() {
+  return PERIPH_COUNT_IRQn;
+}
+
+uint32_t device_getNumInterruptPriorities() {
+  return 1u << __NVIC_PRIO_BITS;
+}
+
+bool device_isReservedInterrupt(uint32_t Irq) {
+  // USB transport and periodic timer
+  return Irq == USB_IRQn || Irq == TC3_IRQn;
+}
+
+void device_attachInterrupt(uint32_t Irq, uint32_t Priority, void (*Handler)()) {
+  Vectors::attach(Irq, Priority, Handler);
+}
+
+void device_detachInterrupt(uint32_t Irq) {
+  Vectors::detach(Irq);
 }
 
 void device_notifyBoot() {
@@ -4,13 +4,15 @@
 #include "ez/protocol.h"
 #include "ez/response.h"
 #include "ez/support.h"
+#include "ez/transport.h"
 
 #include "Arduino.h"
 
+using Transport = UsbCdcTransport<decltype(Serial), Serial>;
+
 void device_setupSendReceive() {
   // Wait for CDC serial connection to be ready. Baud rate is set from the host.
-  while (!Serial)
-    ;
+  Transport::begin();
   device_flushReceiveBuffer();
 
   // We can read and write serial messages synchronously without interrupts
@@ -22,21 +24,177 @@ void device_setupSendReceive() {
 }
 
 bool device_receiveBytes(char Buffer[], uint32_t Count) {
-  uint32_t Received = 0;
-  while (Received < Count) {
-    Received += Serial.readBytes(Buffer + Received, Count - Received);
-  }
-  return true;
+  return Transport::receiveBytes(Buffer, Count);
+}
+
+uint32_t device_receiveBytesPartial(char Buffer[], uint32_t Count) {
+  return Transport::receiveBytesPartial(Buffer, Count);
+}
+
+bool device_receiveReady() {
+  return Transport::receiveReady();
 }
 
 void device_sendBytes(const char *Buffer, size_t Size) {
-  Serial.write(Buffer, Size);
+  Transport::sendBytes(Buffer, Size);
+}
+
+void device_sendv(const IOVec Vec[], uint32_t Count) {
+  Transport::sendv(Vec, Count);
 }
 
 void device_flushReceiveBuffer() {
-  Serial.flush();
+  Transport::flushReceiveBuffer();
+}
+
+//
+// Memory regions: a single SRAM bank, so the entire code buffer is one region
+//
+extern char _scode_buffer;
+extern char _ecode_buffer;
+extern char _sstack;
+extern char _estack;
+
+static const MemoryRegion Regions[] {
+  { RegionCode, 0, RegionExec | RegionWrite, &_scode_buffer, &_ecode_buffer },
+  { RegionStack, 0, RegionWrite, &_sstack, &_estack },
+};
+
+uint32_t device_getMemoryRegions(const MemoryRegion *R[]) {
+  *R = Regions;
+  return c_array_size(Regions);
+}
+
+//
+// Cycle counter: Interrupts are disabled, so the millisecond tick count doesn't
+// advance. SysTick keeps the Arduino configuration (1ms period) and provides
+// the cycles within the current millisecond. LPTMR0 counts OSCERCLK / 4096,
+// which comes from the same crystal as the core clock. It tells us how many
+// SysTick periods passed since the last read, as long as reads are less than
+// 2^16 LPTMR ticks (~16.7s) apart.
+//
+// The RTC runs on the 1kHz LPO and serves as the coarse clock that detects
+// longer intervals. The LPO isn't accurate, so we leave a generous margin.
+//
+constexpr uint32_t CrystalFrequency = 16000000;
+constexpr uint32_t LptmrPrescale = 4096;
+constexpr uint32_t LptmrCycles =
+    static_cast<uint64_t>(F_CPU) * LptmrPrescale / CrystalFrequency;
+
+static_assert(static_cast<uint64_t>(F_CPU) * LptmrPrescale %
+                  CrystalFrequency == 0,
+              "LPTMR ticks must be a whole number of cycles");
+static_assert(2 * LptmrCycles < F_CPU / 1000,
+              "LPTMR ticks must resolve SysTick periods");
+
+static uint32_t LastFine = 0;
+static uint32_t LastCoarse = 0;
+static uint32_t Cycles = 0;
+
+static uint32_t readLptmr() {
+  LPTMR0_CNR = 0; // Latch the counter for reading
+  return LPTMR0_CNR;
+}
+
+void device_setupCycleCounter() {
+  OSC0_CR |= OSC_ERCLKEN;
+  SIM_SCGC5 |= SIM_SCGC5_LPTIMER;
+  LPTMR0_CSR = 0;
+  LPTMR0_PSR = LPTMR_PSR_PCS(3) | LPTMR_PSR_PRESCALE(11); // OSCERCLK / 4096
+  LPTMR0_CMR = 0;
+  LPTMR0_CSR = LPTMR_CSR_TFC | LPTMR_CSR_TEN; // Free-running
+
+  SIM_SOPT1 = (SIM_SOPT1 & ~SIM_SOPT1_OSC32KSEL(3)) | SIM_SOPT1_OSC32KSEL(3);
+  SIM_SCGC6 |= SIM_SCGC6_RTC;
+  RTC_SR = 0;
+  RTC_TPR = 0;
+  RTC_TSR = 0; // Clears the invalid time flag
+  RTC_SR = RTC_SR_TCE;
+
+  LastFine = SYST_RVR - SYST_CVR;
+  LastCoarse = readLptmr();
+  Cycles = 0;
+}
+
+uint32_t device_readCycleCounter() {
+  uint32_t Period = SYST_RVR + 1;
+  uint32_t Fine = SYST_RVR - SYST_CVR;
+  uint32_t Coarse = readLptmr();
+
+  // The elapsed time is congruent to FineDelta modulo the SysTick period and
+  // less than one LPTMR tick away from CoarseDelta
+  uint32_t FineDelta = (Fine + Period - LastFine) % Period;
+  uint32_t CoarseDelta = ((Coarse - LastCoarse) & 0xFFFF) * LptmrCycles;
+  uint32_t Offset = (FineDelta + Period - CoarseDelta % Period) % Period;
+  if (Offset < Period / 2)
+    Cycles += CoarseDelta + Offset;
+  else
+    Cycles += CoarseDelta - (Period - Offset);
+
+  LastFine = Fine;
+  LastCoarse = Coarse;
+  return Cycles;
+}
+
+uint32_t device_getCycleCounterFrequency() {
+  return F_CPU;
+}
+
+// RTC seconds and prescaler on the 1kHz LPO, i.e. 32768 ticks per "second"
+uint32_t device_readMillis() {
+  uint32_t Seconds;
+  uint32_t Ticks;
+  do {
+    Seconds = RTC_TSR;
+    Ticks = RTC_TPR;
+  } while (Seconds != RTC_TSR);
+  return Seconds * 32768 + Ticks;
 }
 
+// LPTMR wraps after ~16.7s. The LPO can be off by tens of percent.
+uint32_t device_getCycleCounterRangeMillis() {
+  return 12000;
+}
+
+// We run with interrupts disabled, so there is no periodic timer
+bool device_startPeriodicTimer(uint32_t PeriodMicros, void (*Handler)()) {
+  return false;
+}
+
+void device_stopPeriodicTimer() {}
+
+uint32_t device_getMaxTimerPeriodMicros() {
+  return 0;
+}
+
+void device_pausePeriodicTimer() {}
+void device_resumePeriodicTimer() {}
+
+//
+// Faults in JIT code don't reboot the device (see fault.cpp)
+//
+extern "C" __attribute__((naked)) void hard_fault_isr() {
+  asm volatile("ldr r0, =__ez_clang_fault_entry\n"
+               "bx r0\n"
+               ".ltorg\n");
+}
+
+// We run with interrupts disabled, so there are no interrupt handlers
+uint32_t device_getNumInterrupts() {
+  return 0;
+}
+
+uint32_t device_getNumInterruptPriorities() {
+  return 0;
+}
+
+bool device_isReservedInterrupt(uint32_t Irq) {
+  return false;
+}
+
+void device_attachInterrupt(uint32_t Irq, uint32_t Priority, void (*Handler)()) {}
+void device_detachInterrupt(uint32_t Irq) {}
+
 void device_notifyBoot() {
   // Blink LED slowly and leave it off
   pinMode(LED_BUILTIN, OUTPUT);
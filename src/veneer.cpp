@@ -0,0 +1,16 @@
+#include "ez/veneer.h"
+
+static void writeHalf(char *P, uint16_t Value) {
+  P[0] = static_cast<char>(Value);
+  P[1] = static_cast<char>(Value >> 8);
+}
+
+void writeVeneer(char *V, uint32_t Target) {
+  writeHalf(V + 0, 0xB403);
+  writeHalf(V + 2, 0x4801);
+  writeHalf(V + 4, 0x9001);
+  writeHalf(V + 6, 0xBD01);
+  Target |= 1;
+  writeHalf(V + 8, Target & 0xFFFF);
+  writeHalf(V + 10, Target >> 16);
+}
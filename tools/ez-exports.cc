@@ -33,6 +33,24 @@ struct EzClang_Sym {
   uint32_t st_value;  // Value or address associated with the symbol
 };
 
+// Header of the slot index table (output), followed by one uint16_t slot per
+// symtab entry
+struct EzClang_SlotsHeader {
+  uint32_t NumSlots;    // Number of slots in the jump table
+  uint32_t MapHash[2];  // Hash of the slot map (low word first)
+};
+
+// Jump table slot (output): Thumb-1 veneer that preserves all registers, same
+// layout as writeVeneer() in the firmware (include/ez/veneer.h)
+struct EzClang_Slot {
+  uint16_t Code[4];
+  uint32_t Target;
+};
+
+static constexpr uint8_t STT_FUNC = 2;
+static constexpr uint16_t NoSlot = 0xffff;
+static constexpr const char *RetiredSlotHandler = "__ez_clang_jumptable_retired";
+
 void exitError(std::string message) {
   fprintf(stderr, "Error: %s\n", message.c_str());
   exit(1);
@@ -44,7 +62,7 @@ void warning(std::string message) {
 
 void printUsage(const char *argv0) {
   fprintf(stderr, "Post-process static symbol table data\n");
-  fprintf(stderr, "Usage: %s [-v] [-q] [--log <logfile>] strtab.section symtab.section whitelist1.txt ...\n", argv0);
+  fprintf(stderr, "Usage: %s [-v] [-q] [--log <logfile>] [--cache <dir>] [--slots <slots.map> --slot-capacity <n>] strtab.section symtab.section whitelist1.txt ...\n", argv0);
 }
 
 std::string int2hex(uint32_t val, size_t width) {
@@ -143,6 +161,92 @@ size_t appendWhitelist(std::vector<std::string> &out, std::filesystem::path file
   return count;
 }
 
+// FNV-1a 64-bit hash for content-addressing inputs
+uint64_t hashBytes(const void *data, size_t size,
+                   uint64_t hash = 0xcbf29ce484222325ull) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < size; i += 1) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+uint64_t hashWhitelists(const std::vector<std::filesystem::path> &filepaths) {
+  uint64_t hash = hashBytes(nullptr, 0);
+  for (const std::filesystem::path &filepath : filepaths) {
+    std::vector<std::byte> content = loadFile(filepath);
+    hash = hashBytes(content.data(), content.size(), hash);
+    hash = hashBytes("\0", 1, hash); // Separator
+  }
+  return hash;
+}
+
+// Precompiled whitelist index: magic, number of names, sorted unique names
+// with null-terminators. It's keyed by the content hash of all whitelists.
+static const char WhitelistIndexMagic[8] = {'E', 'Z', 'W', 'L', 'I', 'D', 'X', 1};
+
+bool loadWhitelistIndex(std::filesystem::path filepath,
+                        std::vector<std::string> &exports) {
+  if (!std::filesystem::exists(filepath))
+    return false;
+  std::vector<std::byte> content = loadFile(filepath);
+  const char *it = reinterpret_cast<const char *>(content.data());
+  const char *end = it + content.size();
+  if (content.size() < sizeof(WhitelistIndexMagic) + 8 ||
+      memcmp(it, WhitelistIndexMagic, sizeof(WhitelistIndexMagic)) != 0) {
+    warning("Ignoring invalid whitelist index '" + filepath.string() + "'");
+    return false;
+  }
+  it += sizeof(WhitelistIndexMagic);
+  uint64_t count;
+  memcpy(&count, it, sizeof(count));
+  it += sizeof(count);
+
+  exports.clear();
+  exports.reserve(count);
+  while (it < end && exports.size() < count) {
+    const char *name = it;
+    it = std::find(it, end, '\0');
+    exports.emplace_back(name, it - name);
+    it += 1;
+  }
+  if (exports.size() != count) {
+    warning("Ignoring truncated whitelist index '" + filepath.string() + "'");
+    return false;
+  }
+  return true;
+}
+
+void writeWhitelistIndex(std::filesystem::path filepath,
+                         const std::vector<std::string> &exports) {
+  std::ofstream os(filepath, std::ios::binary);
+  uint64_t count = exports.size();
+  os.write(WhitelistIndexMagic, sizeof(WhitelistIndexMagic));
+  os.write(reinterpret_cast<const char *>(&count), sizeof(count));
+  for (const std::string &name : exports)
+    os.write(name.c_str(), name.size() + 1);
+  if (!os)
+    warning("Cannot write whitelist index '" + filepath.string() + "'");
+}
+
+// Bump when the output format changes, so cached outputs get rebuilt
+static constexpr uint32_t ExportsFormatVersion = 2;
+
+// Stamp with the hash of all inputs from the last successful run
+uint64_t readStamp(std::filesystem::path filepath) {
+  uint64_t hash = 0;
+  std::ifstream is(filepath);
+  if (is)
+    is >> std::hex >> hash;
+  return hash;
+}
+
+void writeStamp(std::filesystem::path filepath, uint64_t hash) {
+  std::ofstream os(filepath);
+  os << int2hex(hash >> 32, 8) << int2hex(hash & 0xffffffff, 8) << "\n";
+}
+
 std::vector<const Elf32_Sym *> convertSymtab(const std::vector<std::byte> &symtab,
                                              const std::vector<std::byte> &strtab,
                                              bool debugDump) {
@@ -206,6 +310,7 @@ size_t checkStrtab(const std::vector<std::byte> &strtab) {
   return strings.size();
 }
 
+// Exports must be sorted
 void filterSymbols(std::vector<const Elf32_Sym *> &symbols,
                    const std::vector<std::byte> &strtab,
                    const std::vector<std::string> &exports, bool debugDump) {
@@ -217,10 +322,10 @@ void filterSymbols(std::vector<const Elf32_Sym *> &symbols,
     if (symbol->st_name == 0)
       return true;
     std::string name = strtabBase + symbol->st_name;
-    auto it = std::find(exports.begin(), exports.end(), name);
-    if (debugDump && it == exports.end())
+    bool exported = std::binary_search(exports.begin(), exports.end(), name);
+    if (debugDump && !exported)
       printf("'%s' ", name.c_str());
-    return it == exports.end();
+    return !exported;
   };
 
   auto eraseFrom = std::remove_if(symbols.begin(), symbols.end(), notExported);
@@ -300,9 +405,167 @@ reencode(const std::vector<const Elf32_Sym *> &symbols,
   return std::make_pair(std::move(symtabOut), strtabOS.str());
 }
 
+// Slot map: One symbol name per line. The slot index is the line number among
+// non-comment lines. Empty lines reserve a slot. We only ever append, so slots
+// keep their index across firmware rebuilds.
+struct SlotMap {
+  std::vector<std::string> Lines;  // Raw lines, including comments
+  std::vector<std::string> Slots;  // Symbol name per slot
+  size_t Appended = 0;
+  size_t Unassigned = 0;
+};
+
+bool isSlotMapComment(const std::string &line) {
+  return !line.empty() && line[0] == '#';
+}
+
+SlotMap loadSlotMap(std::filesystem::path filepath) {
+  SlotMap map;
+  if (!std::filesystem::exists(filepath))
+    return map;
+  map.Lines = loadTextFile(filepath);
+  for (const std::string &line : map.Lines) {
+    if (isSlotMapComment(line))
+      continue;
+    if (!line.empty() &&
+        std::find(map.Slots.begin(), map.Slots.end(), line) != map.Slots.end())
+      exitError("Duplicate entry '" + line + "' in slot map '" + filepath.string() + "'");
+    map.Slots.push_back(line);
+  }
+  return map;
+}
+
+void writeSlotMap(std::filesystem::path filepath, const SlotMap &map) {
+  std::ofstream os(filepath);
+  for (const std::string &line : map.Lines)
+    os << line << "\n";
+  if (!os)
+    exitError("Cannot write slot map '" + filepath.string() + "'");
+}
+
+bool isFunction(const Elf32_Sym *symbol) {
+  return (symbol->st_info & 0xf) == STT_FUNC;
+}
+
+// Append exported functions that don't have a slot yet. Symbols must be
+// sorted, so new slots are assigned in a deterministic order.
+void assignSlots(SlotMap &map, const std::vector<const Elf32_Sym *> &symbols,
+                 const std::vector<std::byte> &strtab, size_t capacity) {
+  if (map.Slots.size() > capacity)
+    exitError("Slot map has " + std::to_string(map.Slots.size()) +
+              " entries, but the jump table only has " +
+              std::to_string(capacity) + " slots");
+
+  const char *strtabBase = reinterpret_cast<const char *>(strtab.data());
+  std::vector<std::string> known = map.Slots;
+  std::sort(known.begin(), known.end());
+  for (const Elf32_Sym *symbol : symbols) {
+    if (!isFunction(symbol))
+      continue;
+    std::string name = strtabBase + symbol->st_name;
+    if (std::binary_search(known.begin(), known.end(), name))
+      continue;
+    known.insert(std::upper_bound(known.begin(), known.end(), name), name);
+    if (map.Slots.size() == capacity) {
+      map.Unassigned += 1;
+      continue;
+    }
+    map.Slots.push_back(name);
+    map.Lines.push_back(name);
+    map.Appended += 1;
+  }
+}
+
+uint64_t hashSlotMap(const SlotMap &map) {
+  uint64_t hash = hashBytes(nullptr, 0);
+  for (const std::string &name : map.Slots)
+    hash = hashBytes(name.c_str(), name.size() + 1, hash);
+  return hash;
+}
+
+uint32_t findFunction(const std::vector<const Elf32_Sym *> &symbols,
+                      const std::vector<std::byte> &strtab, const std::string &name) {
+  const char *strtabBase = reinterpret_cast<const char *>(strtab.data());
+  for (const Elf32_Sym *symbol : symbols)
+    if (isFunction(symbol) && name == strtabBase + symbol->st_name)
+      return symbol->st_value;
+  return 0;
+}
+
+// Jump table with one veneer per slot. Slots of functions that are no longer
+// exported go to the retired-slot handler, so their index stays reserved.
+std::string emitJumpTable(const SlotMap &map,
+                          const std::vector<const Elf32_Sym *> &symbols,
+                          const std::vector<std::byte> &strtab,
+                          uint32_t retiredAddr) {
+  const char *strtabBase = reinterpret_cast<const char *>(strtab.data());
+  std::vector<std::pair<std::string, uint32_t>> targets;
+  for (const Elf32_Sym *symbol : symbols)
+    if (isFunction(symbol))
+      targets.emplace_back(strtabBase + symbol->st_name, symbol->st_value);
+  std::stable_sort(targets.begin(), targets.end(),
+                   [](const auto &a, const auto &b) { return a.first < b.first; });
+
+  std::string out;
+  out.reserve(map.Slots.size() * sizeof(EzClang_Slot));
+  for (const std::string &name : map.Slots) {
+    auto it = std::lower_bound(targets.begin(), targets.end(), name,
+                               [](const auto &entry, const std::string &name) {
+                                 return entry.first < name;
+                               });
+    bool exported = it != targets.end() && it->first == name;
+    EzClang_Slot slot{{0xb403, 0x4801, 0x9001, 0xbd01},
+                      exported ? it->second : retiredAddr};
+    out.append(reinterpret_cast<const char *>(&slot), sizeof(slot));
+  }
+  return out;
+}
+
+// Slot index per symtab entry, in the order of the output symtab
+std::string emitSlotIndex(const SlotMap &map,
+                          const std::vector<const Elf32_Sym *> &symbols,
+                          const std::vector<std::byte> &strtab) {
+  const char *strtabBase = reinterpret_cast<const char *>(strtab.data());
+  std::vector<std::pair<std::string, uint16_t>> index;
+  for (size_t i = 0; i < map.Slots.size(); i += 1)
+    if (!map.Slots[i].empty())
+      index.emplace_back(map.Slots[i], i);
+  std::sort(index.begin(), index.end());
+
+  uint64_t hash = hashSlotMap(map);
+  EzClang_SlotsHeader header{static_cast<uint32_t>(map.Slots.size()),
+                             {static_cast<uint32_t>(hash),
+                              static_cast<uint32_t>(hash >> 32)}};
+  std::string out(reinterpret_cast<const char *>(&header), sizeof(header));
+  for (const Elf32_Sym *symbol : symbols) {
+    uint16_t slot = NoSlot;
+    std::string name = strtabBase + symbol->st_name;
+    auto it = std::lower_bound(index.begin(), index.end(),
+                               std::make_pair(name, uint16_t(0)));
+    if (isFunction(symbol) && it != index.end() && it->first == name)
+      slot = it->second;
+    out.append(reinterpret_cast<const char *>(&slot), sizeof(slot));
+  }
+  out.resize((out.size() + 3) & ~size_t(3), '\0');
+  return out;
+}
+
 bool g_quiet = false;
 bool g_verbose = false;
 std::filesystem::path g_logfile;
+std::filesystem::path g_cachedir;
+std::filesystem::path g_slotmap;
+size_t g_slotCapacity = 0;
+
+// Stamps include the slot map, because we append to it
+uint64_t stampHash(uint64_t inputHash) {
+  if (g_slotmap.empty() || !std::filesystem::exists(g_slotmap))
+    return inputHash;
+  std::vector<std::string> lines = loadTextFile(g_slotmap);
+  for (const std::string &line : lines)
+    inputHash = hashBytes(line.c_str(), line.size() + 1, inputHash);
+  return inputHash;
+}
 
 int println(const char *__restrict fmt, ...) {
   if (g_quiet)
@@ -340,30 +603,107 @@ int main(int argc, char *argv[]) {
         g_logfile = args[idx + 1];
       return 2;
     }
+    if (arg == "--cache") {
+      if (args.size() > idx + 1)
+        g_cachedir = args[idx + 1];
+      return 2;
+    }
+    if (arg == "--slots") {
+      if (args.size() > idx + 1)
+        g_slotmap = args[idx + 1];
+      return 2;
+    }
+    if (arg == "--slot-capacity") {
+      if (args.size() > idx + 1)
+        g_slotCapacity = std::stoul(args[idx + 1]);
+      return 2;
+    }
     return 0;
   };
 
   std::queue<std::filesystem::path> args = parseArguments(argc, argv, handleOption);
   std::filesystem::path strtabFile = std::move(args.front()); args.pop();
   std::filesystem::path symtabFile = std::move(args.front()); args.pop();
+  std::vector<std::filesystem::path> whitelists;
+  for (; !args.empty(); args.pop())
+    whitelists.push_back(std::move(args.front()));
+
+  std::filesystem::path strtabOutFile = strtabFile;
+  std::filesystem::path symtabOutFile = symtabFile;
+  strtabOutFile.replace_extension(".exports");
+  symtabOutFile.replace_extension(".exports");
+  std::filesystem::path jumptableOutFile = symtabFile;
+  std::filesystem::path slotsOutFile = symtabFile;
+  jumptableOutFile.replace_filename("jumptable.exports");
+  slotsOutFile.replace_filename("slots.exports");
+  if (!g_slotmap.empty() && (g_slotCapacity == 0 || g_slotCapacity >= NoSlot))
+    exitError("Jump table requires --slot-capacity between 1 and " +
+              std::to_string(NoSlot - 1));
+
+  const std::vector<std::byte> strtabIn = loadFile(strtabFile);
+  const std::vector<std::byte> symtabIn = loadFile(symtabFile);
+  uint64_t whitelistHash = hashWhitelists(whitelists);
+
+  // Skip the run entirely if all inputs match the last successful run
+  std::filesystem::path stampFile;
+  uint64_t inputHash = 0;
+  if (!g_cachedir.empty()) {
+    std::filesystem::create_directories(g_cachedir);
+    stampFile = g_cachedir / "exports.stamp";
+    inputHash = hashBytes(strtabIn.data(), strtabIn.size(), whitelistHash);
+    inputHash = hashBytes(symtabIn.data(), symtabIn.size(), inputHash);
+    // Outputs also depend on the tool itself and the options it runs with
+    std::string options = std::to_string(ExportsFormatVersion) + '\0' +
+                          g_logfile.string() + '\0' + g_slotmap.string() +
+                          '\0' + std::to_string(g_slotCapacity);
+    inputHash = hashBytes(options.data(), options.size(), inputHash);
+    bool optionalOutputsExist =
+        (g_logfile.empty() || std::filesystem::exists(g_logfile)) &&
+        (g_slotmap.empty() || (std::filesystem::exists(jumptableOutFile) &&
+                               std::filesystem::exists(slotsOutFile)));
+    if (readStamp(stampFile) == stampHash(inputHash) && optionalOutputsExist &&
+        std::filesystem::exists(strtabOutFile) &&
+        std::filesystem::exists(symtabOutFile)) {
+      println("Up to date: %s", stampFile.c_str());
+      return 0;
+    }
+  }
 
   println("Inputs:");
 
-  const std::vector<std::byte> strtabIn = loadFile(strtabFile);
   size_t numStringsIn = checkStrtab(strtabIn);
   println("  strtab: %s, size: %lu, strings: %lu", strtabFile.c_str(), strtabIn.size(), numStringsIn);
 
-  const std::vector<std::byte> symtabIn = loadFile(symtabFile);
   std::vector<const Elf32_Sym *> symbols = convertSymtab(symtabIn, strtabIn, g_verbose && !g_quiet);
   size_t numSymbolsIn = symbols.size();
   println("  symtab: %s, size: %lu, symbols: %lu", symtabFile.c_str(), symtabIn.size(), numSymbolsIn);
 
+  // The retired-slot handler isn't exported, so find it before filtering
+  uint32_t retiredAddr = 0;
+  if (!g_slotmap.empty()) {
+    retiredAddr = findFunction(symbols, strtabIn, RetiredSlotHandler);
+    if (retiredAddr == 0)
+      exitError("Function '" + std::string(RetiredSlotHandler) +
+                "' required for the jump table not found in symtab");
+  }
+
   println("Whitelists:");
   std::vector<std::string> exports;
-  while (!args.empty()) {
-    size_t items = appendWhitelist(exports, args.front());
-    println("  %s (%lu)", args.front().c_str(), items);
-    args.pop();
+  std::filesystem::path indexFile;
+  if (!g_cachedir.empty())
+    indexFile = g_cachedir / ("whitelists-" + int2hex(whitelistHash >> 32, 8) +
+                              int2hex(whitelistHash & 0xffffffff, 8) + ".idx");
+  if (!indexFile.empty() && loadWhitelistIndex(indexFile, exports)) {
+    println("  %s (%lu)", indexFile.c_str(), exports.size());
+  } else {
+    for (const std::filesystem::path &whitelist : whitelists) {
+      size_t items = appendWhitelist(exports, whitelist);
+      println("  %s (%lu)", whitelist.c_str(), items);
+    }
+    std::sort(exports.begin(), exports.end());
+    exports.erase(std::unique(exports.begin(), exports.end()), exports.end());
+    if (!indexFile.empty())
+      writeWhitelistIndex(indexFile, exports);
   }
 
   filterSymbols(symbols, strtabIn, exports, g_verbose && !g_quiet);
@@ -381,9 +721,26 @@ int main(int argc, char *argv[]) {
   float strtabRatio = (100.f * strtabOut.size()) / strtabIn.size() - 100.f;
   println("  memory footprint: symtab %.1f%%, strtab %.1f%%", symtabRatio, strtabRatio);
 
+  SlotMap slotMap;
+  std::string jumptableOut;
+  std::string slotsOut;
+  if (!g_slotmap.empty()) {
+    slotMap = loadSlotMap(g_slotmap);
+    assignSlots(slotMap, symbols, strtabIn, g_slotCapacity);
+    println("  slot map: %s, slots: %lu of %lu, appended: %lu", g_slotmap.c_str(),
+            slotMap.Slots.size(), g_slotCapacity, slotMap.Appended);
+    if (slotMap.Unassigned > 0)
+      warning("Jump table is full, " + std::to_string(slotMap.Unassigned) +
+              " functions are only available at their direct address");
+    if (slotMap.Appended > 0)
+      writeSlotMap(g_slotmap, slotMap);
+    jumptableOut = emitJumpTable(slotMap, symbols, strtabIn, retiredAddr);
+    slotsOut = emitSlotIndex(slotMap, symbols, strtabIn);
+  }
+
   println("Outputs:");
-  strtabFile.replace_extension(".exports");
-  symtabFile.replace_extension(".exports");
+  strtabFile = strtabOutFile;
+  symtabFile = symtabOutFile;
   size_t numStringsOut = std::count(strtabOut.begin(), strtabOut.end(), '\0');
   println("  strtab: %s, size: %lu, strings: %lu", strtabFile.c_str(), strtabOut.size(), numStringsOut);
   println("  symtab: %s, size: %lu, symbols: %lu", symtabFile.c_str(), symtabSize, numSymbolsOut);
@@ -396,6 +753,24 @@ int main(int argc, char *argv[]) {
   symtabOS.write(reinterpret_cast<char*>(symtabOut.get()), symtabSize);
   symtabOS.close();
 
+  if (!g_slotmap.empty()) {
+    println("  jumptable: %s, size: %lu, slots: %lu", jumptableOutFile.c_str(),
+            jumptableOut.size(), slotMap.Slots.size());
+    println("  slots: %s, size: %lu", slotsOutFile.c_str(), slotsOut.size());
+
+    std::ofstream jumptableOS(jumptableOutFile, std::ios::binary);
+    jumptableOS.write(jumptableOut.data(), jumptableOut.size());
+    jumptableOS.close();
+
+    std::ofstream slotsOS(slotsOutFile, std::ios::binary);
+    slotsOS.write(slotsOut.data(), slotsOut.size());
+    slotsOS.close();
+  }
+
+  // The slot map may have grown in this run, so stamp its current content
+  if (!stampFile.empty())
+    writeStamp(stampFile, stampHash(inputHash));
+
   println("Done");
   return 0;
 }
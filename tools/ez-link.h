@@ -0,0 +1,472 @@
+// Host-side helpers for talking the ez-clang RPC protocol over a byte stream
+//
+// Header-only, shared by the host tools in this directory. Frames are kept in
+// wire format: a 32-byte header with four 64-bit little-endian fields (total
+// size, op-code, sequence ID, tag address) followed by the payload.
+//
+#ifndef EZ_TOOLS_LINK_H
+#define EZ_TOOLS_LINK_H
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace ez {
+
+// Magic sequence is symmetric, we can ignore endianness
+constexpr uint64_t SetupMagic = 0x012357BDBD572301ull;
+constexpr size_t MessageHeaderSize = 32;
+
+enum OpCode : uint32_t {
+  Setup,
+  Hangup,
+  Result,
+  Call,
+  ReportValue,
+  ReportString,
+  Nak,
+  StreamData,
+  ResultPart,
+  LastOpC = ResultPart
+};
+
+inline const char *opCodeName(uint32_t opc) {
+  switch (opc) {
+  case Setup: return "Setup";
+  case Hangup: return "Hangup";
+  case Result: return "Result";
+  case Call: return "Call";
+  case ReportValue: return "ReportValue";
+  case ReportString: return "ReportString";
+  case Nak: return "Nak";
+  case StreamData: return "StreamData";
+  case ResultPart: return "ResultPart";
+  default: return "Unknown";
+  }
+}
+
+inline uint64_t readLE64(const uint8_t *data) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; i -= 1)
+    value = (value << 8) | data[i];
+  return value;
+}
+
+inline void writeLE64(uint8_t *data, uint64_t value) {
+  for (int i = 0; i < 8; i += 1)
+    data[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+struct Frame {
+  std::vector<uint8_t> bytes; // Header and payload
+
+  uint64_t size() const { return readLE64(bytes.data()); }
+  uint32_t opcode() const { return readLE64(bytes.data() + 8); }
+  uint32_t seqID() const { return readLE64(bytes.data() + 16); }
+  uint32_t tagAddr() const { return readLE64(bytes.data() + 24); }
+  const uint8_t *payload() const { return bytes.data() + MessageHeaderSize; }
+  size_t payloadSize() const { return bytes.size() - MessageHeaderSize; }
+
+  void setSeqID(uint32_t seq) { writeLE64(bytes.data() + 16, seq); }
+};
+
+inline Frame makeFrame(uint32_t opc, uint32_t seq, uint32_t tag,
+                       const uint8_t *payload, size_t size) {
+  Frame f;
+  f.bytes.resize(MessageHeaderSize + size);
+  writeLE64(f.bytes.data(), MessageHeaderSize + size);
+  writeLE64(f.bytes.data() + 8, opc);
+  writeLE64(f.bytes.data() + 16, seq);
+  writeLE64(f.bytes.data() + 24, tag);
+  if (size > 0)
+    memcpy(f.bytes.data() + MessageHeaderSize, payload, size);
+  return f;
+}
+
+// Incremental parser for one direction of the byte stream. Before the first
+// frame (and after each Hangup) the stream must synchronize on SetupMagic.
+class FrameParser {
+public:
+  enum Event { None, Magic, FrameReady };
+
+  explicit FrameParser(bool expectMagic) : synced_(!expectMagic) {}
+
+  void feed(const uint8_t *data, size_t size) {
+    buffer_.insert(buffer_.end(), data, data + size);
+  }
+
+  // Extract the next event from the buffered bytes. SetupMagic can't be
+  // mistaken for a frame header, because its size field exceeds 32-bit.
+  Event next(Frame &out) {
+    const uint8_t *magic = reinterpret_cast<const uint8_t *>(&SetupMagic);
+    while (true) {
+      if (buffer_.size() >= sizeof(SetupMagic) &&
+          memcmp(buffer_.data(), magic, sizeof(SetupMagic)) == 0) {
+        buffer_.erase(buffer_.begin(), buffer_.begin() + sizeof(SetupMagic));
+        synced_ = true;
+        return Magic;
+      }
+      if (!synced_) {
+        if (buffer_.size() < sizeof(SetupMagic))
+          return None;
+        buffer_.erase(buffer_.begin()); // Skip noise before the handshake
+        continue;
+      }
+      if (buffer_.size() < MessageHeaderSize)
+        return None;
+      uint64_t size = readLE64(buffer_.data());
+      if (size < MessageHeaderSize || size >= 0x100000000ull) {
+        // Malformed header: wait for the next handshake
+        synced_ = false;
+        malformed_ += 1;
+        continue;
+      }
+      if (buffer_.size() < size)
+        return None;
+      out.bytes.assign(buffer_.begin(), buffer_.begin() + size);
+      buffer_.erase(buffer_.begin(), buffer_.begin() + size);
+      if (out.opcode() == Hangup && resyncOnHangup_)
+        synced_ = false;
+      return FrameReady;
+    }
+  }
+
+  void resyncOnHangup(bool value) { resyncOnHangup_ = value; }
+  bool synced() const { return synced_; }
+  size_t malformed() const { return malformed_; }
+
+private:
+  std::vector<uint8_t> buffer_;
+  size_t malformed_ = 0;
+  bool synced_;
+  bool resyncOnHangup_ = true;
+};
+
+using Clock = std::chrono::steady_clock;
+
+// Blocking byte stream with timeouts on top of a file descriptor
+class Link {
+public:
+  Link() = default;
+  explicit Link(int fd, pid_t child = -1) : fd_(fd), child_(child) {}
+  Link(const Link &) = delete;
+  Link &operator=(const Link &) = delete;
+  Link(Link &&other) { *this = std::move(other); }
+  Link &operator=(Link &&other) {
+    std::swap(fd_, other.fd_);
+    std::swap(child_, other.child_);
+    return *this;
+  }
+  ~Link() { close(); }
+
+  int fd() const { return fd_; }
+  bool isOpen() const { return fd_ >= 0; }
+
+  bool writeAll(const uint8_t *data, size_t size) {
+    while (size > 0) {
+      ssize_t n = ::write(fd_, data, size);
+      if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        continue;
+      if (n <= 0)
+        return false;
+      data += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  bool writeFrame(const Frame &f) { return writeAll(f.bytes.data(), f.bytes.size()); }
+
+  // Read whatever is available within the timeout (0 bytes on timeout)
+  ssize_t readSome(uint8_t *data, size_t size, int timeoutMs) {
+    pollfd pfd{fd_, POLLIN, 0};
+    int ready = ::poll(&pfd, 1, timeoutMs);
+    if (ready < 0)
+      return errno == EINTR ? 0 : -1;
+    if (ready == 0)
+      return 0;
+    ssize_t n = ::read(fd_, data, size);
+    if (n == 0)
+      return -1; // EOF
+    if (n < 0)
+      return errno == EINTR || errno == EAGAIN ? 0 : -1;
+    return n;
+  }
+
+  void close() {
+    if (fd_ >= 0)
+      ::close(fd_);
+    fd_ = -1;
+    if (child_ > 0) {
+      ::kill(child_, SIGTERM);
+      ::waitpid(child_, nullptr, 0);
+    }
+    child_ = -1;
+  }
+
+private:
+  int fd_ = -1;
+  pid_t child_ = -1;
+};
+
+inline speed_t baudToSpeed(unsigned baud) {
+  switch (baud) {
+  case 9600: return B9600;
+  case 19200: return B19200;
+  case 38400: return B38400;
+  case 57600: return B57600;
+  case 115200: return B115200;
+  case 230400: return B230400;
+  case 460800: return B460800;
+  case 921600: return B921600;
+  default: return 0;
+  }
+}
+
+// Open a serial device in raw mode. USB CDC devices ignore the baud rate.
+inline bool openSerial(const std::string &path, unsigned baud, Link &link,
+                       std::string &err) {
+  int fd = ::open(path.c_str(), O_RDWR | O_NOCTTY);
+  if (fd < 0) {
+    err = path + " (" + std::strerror(errno) + ")";
+    return false;
+  }
+  termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    if (speed_t speed = baudToSpeed(baud)) {
+      cfsetispeed(&tio, speed);
+      cfsetospeed(&tio, speed);
+    }
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  link = Link(fd);
+  return true;
+}
+
+// Spawn a command via /bin/sh and talk to it through its stdin/stdout, e.g.
+// the host variant of the firmware
+inline bool spawnProcess(const std::string &command, Link &link,
+                         std::string &err) {
+  int fds[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    err = std::string("socketpair (") + std::strerror(errno) + ")";
+    return false;
+  }
+  pid_t pid = ::fork();
+  if (pid < 0) {
+    err = std::string("fork (") + std::strerror(errno) + ")";
+    return false;
+  }
+  if (pid == 0) {
+    ::dup2(fds[1], STDIN_FILENO);
+    ::dup2(fds[1], STDOUT_FILENO);
+    ::close(fds[0]);
+    ::close(fds[1]);
+    ::execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char *>(nullptr));
+    _exit(127);
+  }
+  ::close(fds[1]);
+  link = Link(fds[0], pid);
+  return true;
+}
+
+// Read the next frame from the link. Returns false on timeout or EOF.
+inline bool readFrame(Link &link, FrameParser &parser, Frame &out,
+                      FrameParser::Event &event, int timeoutMs) {
+  auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+  while (true) {
+    event = parser.next(out);
+    if (event != FrameParser::None)
+      return true;
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - Clock::now()).count();
+    if (remaining <= 0)
+      return false;
+    uint8_t chunk[512];
+    ssize_t n = link.readSome(chunk, sizeof(chunk), static_cast<int>(remaining));
+    if (n < 0)
+      return false;
+    parser.feed(chunk, n);
+  }
+}
+
+// Payload parsing helpers: all integers are 64-bit little-endian and strings
+// are size-prefixed
+inline bool parseString(const uint8_t *&data, const uint8_t *end,
+                        std::string &out) {
+  if (end - data < 8)
+    return false;
+  uint64_t len = readLE64(data);
+  data += 8;
+  if (static_cast<uint64_t>(end - data) < len)
+    return false;
+  out.assign(reinterpret_cast<const char *>(data), len);
+  data += len;
+  return true;
+}
+
+inline bool parseUInt64(const uint8_t *&data, const uint8_t *end,
+                        uint64_t &out) {
+  if (end - data < 8)
+    return false;
+  out = readLE64(data);
+  data += 8;
+  return true;
+}
+
+inline void appendUInt64(std::vector<uint8_t> &out, uint64_t value) {
+  size_t at = out.size();
+  out.resize(at + 8);
+  writeLE64(out.data() + at, value);
+}
+
+inline void appendString(std::vector<uint8_t> &out, const std::string &str) {
+  appendUInt64(out, str.size());
+  out.insert(out.end(), str.begin(), str.end());
+}
+
+// Contents of the Setup message. Memory regions are optional, because older
+// firmware doesn't send them.
+struct SetupInfo {
+  struct Region {
+    uint64_t kind, bank, flags, addr, size;
+  };
+  enum RegionKind : uint64_t { RegionCode, RegionData, RegionStack };
+
+  std::string version;
+  uint64_t codeBuffer = 0;
+  uint64_t codeBufferSize = 0;
+  std::vector<std::pair<std::string, uint64_t>> symbols;
+  std::vector<Region> regions;
+
+  uint64_t symbol(const std::string &name) const {
+    for (const auto &sym : symbols)
+      if (sym.first == name)
+        return sym.second;
+    return 0;
+  }
+};
+
+inline bool parseSetup(const Frame &f, SetupInfo &out) {
+  const uint8_t *data = f.payload();
+  const uint8_t *end = data + f.payloadSize();
+  uint64_t numSymbols;
+  if (!parseString(data, end, out.version) ||
+      !parseUInt64(data, end, out.codeBuffer) ||
+      !parseUInt64(data, end, out.codeBufferSize) ||
+      !parseUInt64(data, end, numSymbols))
+    return false;
+  out.symbols.clear();
+  for (uint64_t i = 0; i < numSymbols; i += 1) {
+    std::string name;
+    uint64_t addr;
+    if (!parseString(data, end, name) || !parseUInt64(data, end, addr))
+      return false;
+    out.symbols.emplace_back(std::move(name), addr);
+  }
+  out.regions.clear();
+  uint64_t numRegions;
+  if (data == end || !parseUInt64(data, end, numRegions))
+    return data == end;
+  for (uint64_t i = 0; i < numRegions; i += 1) {
+    SetupInfo::Region r;
+    if (!parseUInt64(data, end, r.kind) || !parseUInt64(data, end, r.bank) ||
+        !parseUInt64(data, end, r.flags) || !parseUInt64(data, end, r.addr) ||
+        !parseUInt64(data, end, r.size))
+      return false;
+    out.regions.push_back(r);
+  }
+  return true;
+}
+
+inline Frame makeSetupFrame(const SetupInfo &info) {
+  std::vector<uint8_t> payload;
+  appendString(payload, info.version);
+  appendUInt64(payload, info.codeBuffer);
+  appendUInt64(payload, info.codeBufferSize);
+  appendUInt64(payload, info.symbols.size());
+  for (const auto &sym : info.symbols) {
+    appendString(payload, sym.first);
+    appendUInt64(payload, sym.second);
+  }
+  appendUInt64(payload, info.regions.size());
+  for (const SetupInfo::Region &r : info.regions) {
+    appendUInt64(payload, r.kind);
+    appendUInt64(payload, r.bank);
+    appendUInt64(payload, r.flags);
+    appendUInt64(payload, r.addr);
+    appendUInt64(payload, r.size);
+  }
+  return makeFrame(Setup, 0, 0, payload.data(), payload.size());
+}
+
+// Decoder for StreamData payloads: record size, index of the first record,
+// total number of records dropped on the device, followed by the records.
+// Chunks must be fed in order. A gap in record indices means that chunks got
+// lost on the link (they are never retransmitted).
+class StreamDecoder {
+public:
+  // Returns false for malformed payloads
+  template <typename RecordFn>
+  bool feed(const uint8_t *data, size_t size, RecordFn &&onRecord) {
+    const uint8_t *end = data + size;
+    uint64_t recordSize, first, dropped;
+    if (!parseUInt64(data, end, recordSize) || !parseUInt64(data, end, first) ||
+        !parseUInt64(data, end, dropped) || recordSize == 0 ||
+        (end - data) % recordSize != 0)
+      return false;
+    if (recordSize != recordSize_) {
+      recordSize_ = recordSize; // Stream was reconfigured
+      next_ = first;
+    }
+    if (first > next_)
+      lost_ += first - next_;
+    next_ = first;
+    dropped_ = dropped;
+    for (; data < end; data += recordSize) {
+      onRecord(next_, data, static_cast<size_t>(recordSize));
+      next_ += 1;
+      records_ += 1;
+    }
+    chunks_ += 1;
+    return true;
+  }
+
+  uint64_t recordSize() const { return recordSize_; }
+  uint64_t records() const { return records_; }
+  uint64_t chunks() const { return chunks_; }
+  uint64_t dropped() const { return dropped_; }
+  uint64_t lost() const { return lost_; }
+
+private:
+  uint64_t recordSize_ = 0;
+  uint64_t next_ = 0;
+  uint64_t records_ = 0;
+  uint64_t chunks_ = 0;
+  uint64_t dropped_ = 0;
+  uint64_t lost_ = 0;
+};
+
+} // namespace ez
+
+#endif // EZ_TOOLS_LINK_H
@@ -0,0 +1,662 @@
+// Share one device between many ez-clang clients
+//
+// Build: g++ -std=c++17 -O2 -o ez-mux tools/ez-mux.cc
+//
+// The daemon owns the link to the device (--device or --exec) and creates one
+// pseudo-terminal per client (--link <path> --clients <n> gives <path>-0 to
+// <path>-<n-1>). Each client sees a device of its own:
+//
+// Setup:  The code buffer is split into equal slices, one per client. Memory
+//         regions from the Setup message are clipped to the slice.
+// Calls:  Calls from all clients go into one queue and the device gets them
+//         one at a time. Sequence IDs are remapped on the way, so they can't
+//         collide between clients.
+// Output: Result and ResultPart go back to the caller. ReportValue and
+//         ReportString go to the client whose call is in flight or, in between
+//         calls, to the client that started the asynchronous function.
+//         StreamData goes to the client that configured the stream.
+// Hangup: A Hangup from a client ends its own session only. The mux confirms
+//         it and the slice is free for the next client. A Hangup from the
+//         device ends all sessions.
+//
+// Devices that wait for the handshake (native USB ports and the host variant)
+// get it at startup and after each Hangup. That's the default with --exec and
+// --handshake enables it for --device. A client that sends the handshake
+// itself restarts its session and gets the handshake and its Setup again.
+//
+// Timeouts: --timeout applies to the startup and to each call. A call that
+// waits longer for the device, e.g. because JIT code hangs in a loop, fails
+// with an error result. Its late result from the device is dropped.
+//
+// Device state beyond the code buffer is shared: interrupt handlers, schedules,
+// trampolines and the telemetry stream are first-come, first-served. Frame
+// CRCs (EZ_CLANG_FRAME_CRC) are not supported.
+//
+#include "ez-link.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <csignal>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+void exitError(std::string message) {
+  fprintf(stderr, "Error: %s\n", message.c_str());
+  exit(1);
+}
+
+void warning(std::string message) {
+  fprintf(stderr, "Warning: %s\n", message.c_str());
+}
+
+bool g_quiet = false;
+
+int println(const char *__restrict fmt, ...) {
+  if (g_quiet)
+    return 0;
+  va_list args;
+  va_start(args, fmt);
+  int len = vprintf(fmt, args);
+  va_end(args);
+  putchar('\n');
+  fflush(stdout);
+  return len;
+}
+
+void printUsage(const char *argv0) {
+  fprintf(stderr, "Share one device between many ez-clang clients\n");
+  fprintf(stderr, "Usage: %s (--device <tty> | --exec <cmd>) --link <path> [--clients <n>]\n"
+                  "       %*s [--baud <rate>] [--handshake] [--timeout <ms>] [-q]\n", argv0, (int)strlen(argv0), "");
+}
+
+volatile sig_atomic_t g_interrupted = 0;
+
+void onInterrupt(int) { g_interrupted = 1; }
+
+constexpr size_t NoClient = SIZE_MAX;
+
+// Slices start at this alignment
+constexpr uint64_t SliceAlign = 32;
+
+struct Client {
+  std::string linkPath;
+  int master = -1;
+  bool connected = false;  // Slave side of the pseudo-terminal is open
+  bool inSession = false;  // Got the Setup message and didn't hang up yet
+  bool wantsSession = false; // Waiting for the device to restart
+  ez::FrameParser parser{false};
+  ez::Frame setup;
+  uint64_t calls = 0;
+};
+
+using Clock = std::chrono::steady_clock;
+
+struct PendingCall {
+  size_t client;
+  ez::Frame frame;
+  Clock::time_point enqueued;
+};
+
+class Mux {
+public:
+  Mux(ez::Link &device, bool handshake, int timeoutMs)
+      : device_(device), handshake_(handshake), timeoutMs_(timeoutMs) {}
+
+  void createClients(const std::string &linkPath, size_t count);
+  bool waitForDevice();
+  void run();
+  void shutdown();
+
+private:
+  bool sendHandshake();
+  void updateSetup(const ez::Frame &setup);
+  uint32_t lookup(const std::string &name);
+
+  void checkConnect(size_t idx);
+  void disconnect(size_t idx);
+  void sendToClient(size_t idx, const ez::Frame &f);
+  void startSession(size_t idx);
+  void endSession(size_t idx);
+
+  void onClientData(size_t idx, const uint8_t *data, size_t size);
+  void onDeviceData(const uint8_t *data, size_t size);
+  void onDeviceFrame(const ez::Frame &f);
+  void dispatch();
+  void failCall(size_t idx, uint32_t seqID, const std::string &message);
+  void checkTimeouts();
+
+  ez::Link &device_;
+  bool handshake_;
+  int timeoutMs_;
+  ez::FrameParser deviceParser_{true};
+  std::vector<Client> clients_;
+  std::deque<PendingCall> queue_;
+  ez::SetupInfo setup_;
+  bool deviceReady_ = false;
+
+  // Endpoints that make a client the owner of device-initiated messages
+  uint32_t executeAsyncAddr_ = 0;
+  uint32_t streamConfigureAddr_ = 0;
+  size_t asyncOwner_ = NoClient;
+  size_t streamOwner_ = NoClient;
+
+  // The call on the device. Its client is NoClient if the caller went away.
+  bool inFlight_ = false;
+  size_t inFlightClient_ = NoClient;
+  uint32_t inFlightClientSeqID_ = 0;
+  uint32_t inFlightSeqID_ = 0;
+  Clock::time_point inFlightSince_;
+  uint32_t nextSeqID_ = 1;
+};
+
+//
+// Clients
+//
+void Mux::createClients(const std::string &linkPath, size_t count) {
+  clients_.resize(count);
+  for (size_t i = 0; i < count; i += 1) {
+    Client &c = clients_[i];
+    c.master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (c.master < 0 || grantpt(c.master) != 0 || unlockpt(c.master) != 0)
+      exitError(std::string("Cannot create pseudo-terminal (") + std::strerror(errno) + ")");
+    const char *slaveName = ptsname(c.master);
+
+    // Open and close the slave side once: the master reports POLLHUP until a
+    // client opens it, so we can tell when clients come and go
+    int slave = open(slaveName, O_RDWR | O_NOCTTY);
+    termios tio;
+    if (slave >= 0 && tcgetattr(slave, &tio) == 0) {
+      cfmakeraw(&tio);
+      tcsetattr(slave, TCSANOW, &tio);
+    }
+    if (slave >= 0)
+      close(slave);
+
+    c.linkPath = linkPath + "-" + std::to_string(i);
+    std::filesystem::remove(c.linkPath);
+    if (symlink(slaveName, c.linkPath.c_str()) != 0)
+      exitError("Cannot create link " + c.linkPath + " (" + std::strerror(errno) + ")");
+  }
+}
+
+void Mux::checkConnect(size_t idx) {
+  Client &c = clients_[idx];
+  pollfd pfd{c.master, POLLIN, 0};
+  if (poll(&pfd, 1, 0) < 0 || (pfd.revents & POLLHUP))
+    return;
+  c.connected = true;
+  c.parser = ez::FrameParser(false);
+  c.parser.resyncOnHangup(false);
+  println("Client %zu connected", idx);
+  startSession(idx);
+}
+
+void Mux::disconnect(size_t idx) {
+  endSession(idx);
+  clients_[idx].connected = false;
+  println("Client %zu disconnected after %" PRIu64 " calls", idx,
+          clients_[idx].calls);
+}
+
+void Mux::sendToClient(size_t idx, const ez::Frame &f) {
+  Client &c = clients_[idx];
+  const uint8_t *data = f.bytes.data();
+  size_t size = f.bytes.size();
+  while (size > 0) {
+    ssize_t n = write(c.master, data, size);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+      continue;
+    if (n <= 0)
+      return; // Client went away, we notice on the next poll
+    data += n;
+    size -= n;
+  }
+}
+
+// The client gets the handshake and the Setup message with its own slice
+void Mux::startSession(size_t idx) {
+  Client &c = clients_[idx];
+  if (c.inSession)
+    return;
+  c.wantsSession = !deviceReady_;
+  if (c.wantsSession)
+    return;
+  ez::Frame magic;
+  magic.bytes.resize(sizeof(ez::SetupMagic));
+  memcpy(magic.bytes.data(), &ez::SetupMagic, sizeof(ez::SetupMagic));
+  sendToClient(idx, magic);
+  sendToClient(idx, c.setup);
+  c.inSession = true;
+  c.calls = 0;
+}
+
+// Drop everything the client left behind. A call in flight finishes on the
+// device, but the result goes nowhere.
+void Mux::endSession(size_t idx) {
+  clients_[idx].inSession = false;
+  clients_[idx].wantsSession = false;
+  for (auto it = queue_.begin(); it != queue_.end();)
+    it = it->client == idx ? queue_.erase(it) : it + 1;
+  if (inFlight_ && inFlightClient_ == idx)
+    inFlightClient_ = NoClient;
+  if (asyncOwner_ == idx)
+    asyncOwner_ = NoClient;
+  if (streamOwner_ == idx)
+    streamOwner_ = NoClient;
+}
+
+void Mux::onClientData(size_t idx, const uint8_t *data, size_t size) {
+  Client &c = clients_[idx];
+  c.parser.feed(data, size);
+  ez::Frame f;
+  while (true) {
+    ez::FrameParser::Event event = c.parser.next(f);
+    if (event == ez::FrameParser::None)
+      return;
+    if (event == ez::FrameParser::Magic) {
+      // Handshake from a client that expects a native USB port. It might have
+      // missed the Setup that we sent when it connected, so start over.
+      if (c.inSession) {
+        endSession(idx);
+        println("Client %zu restarted its session", idx);
+      }
+      startSession(idx);
+      continue;
+    }
+    switch (f.opcode()) {
+    case ez::Call:
+      if (c.inSession) {
+        queue_.push_back(PendingCall{idx, std::move(f), Clock::now()});
+        c.calls += 1;
+      }
+      break;
+    case ez::Hangup: {
+      // Only this session ends, the device stays up for the others
+      uint8_t success = 0;
+      sendToClient(idx, ez::makeFrame(ez::Hangup, 0, 0, &success, 1));
+      endSession(idx);
+      println("Client %zu hung up after %" PRIu64 " calls", idx, c.calls);
+      break;
+    }
+    default:
+      warning("Client " + std::to_string(idx) + " sent unexpected " +
+              ez::opCodeName(f.opcode()) + " message");
+      break;
+    }
+  }
+}
+
+//
+// Device
+//
+void Mux::updateSetup(const ez::Frame &frame) {
+  if (!ez::parseSetup(frame, setup_))
+    exitError("Malformed Setup message from device");
+  for (const auto &sym : setup_.symbols)
+    if (sym.first == "__ez_clang_crc32")
+      exitError("Firmware uses frame CRCs, which ez-mux doesn't support");
+
+  uint64_t slice = (setup_.codeBufferSize / clients_.size()) & ~(SliceAlign - 1);
+  if (slice == 0)
+    exitError("Code buffer is too small for " + std::to_string(clients_.size()) + " clients");
+
+  for (size_t i = 0; i < clients_.size(); i += 1) {
+    ez::SetupInfo info = setup_;
+    uint64_t begin = (setup_.codeBuffer + i * slice + SliceAlign - 1) & ~(SliceAlign - 1);
+    uint64_t end = setup_.codeBuffer + (i + 1) * slice;
+    if (i == clients_.size() - 1)
+      end = setup_.codeBuffer + setup_.codeBufferSize;
+    info.codeBuffer = begin;
+    info.codeBufferSize = end - begin;
+
+    // Code and data regions are parts of the code buffer. The stack stays.
+    info.regions.clear();
+    for (ez::SetupInfo::Region r : setup_.regions) {
+      if (r.kind == ez::SetupInfo::RegionCode || r.kind == ez::SetupInfo::RegionData) {
+        uint64_t rBegin = std::max(r.addr, begin);
+        uint64_t rEnd = std::min(r.addr + r.size, end);
+        if (rBegin >= rEnd)
+          continue;
+        r.addr = rBegin;
+        r.size = rEnd - rBegin;
+      }
+      info.regions.push_back(r);
+    }
+    clients_[i].setup = ez::makeSetupFrame(info);
+  }
+}
+
+// Synchronous lookup before any client is connected
+uint32_t Mux::lookup(const std::string &name) {
+  uint64_t lookupAddr = setup_.symbol("__ez_clang_rpc_lookup");
+  if (lookupAddr == 0)
+    return 0;
+  std::vector<uint8_t> payload;
+  ez::appendUInt64(payload, 1);
+  ez::appendString(payload, name);
+  uint32_t seq = nextSeqID_++;
+  if (!device_.writeFrame(ez::makeFrame(ez::Call, seq, lookupAddr, payload.data(),
+                                        payload.size())))
+    return 0;
+  ez::Frame result;
+  ez::FrameParser::Event event;
+  while (ez::readFrame(device_, deviceParser_, result, event, timeoutMs_)) {
+    if (event != ez::FrameParser::FrameReady || result.opcode() != ez::Result ||
+        result.seqID() != seq)
+      continue;
+    const uint8_t *data = result.payload();
+    const uint8_t *end = data + result.payloadSize();
+    uint64_t count, addr;
+    if (end - data < 1 || data[0] != 0)
+      return 0;
+    data += 1;
+    if (!ez::parseUInt64(data, end, count) || count != 1 || !ez::parseUInt64(data, end, addr))
+      return 0;
+    return addr;
+  }
+  return 0;
+}
+
+bool Mux::sendHandshake() {
+  if (!handshake_)
+    return true;
+  return device_.writeAll(reinterpret_cast<const uint8_t *>(&ez::SetupMagic),
+                          sizeof(ez::SetupMagic));
+}
+
+bool Mux::waitForDevice() {
+  if (!sendHandshake())
+    return false;
+  ez::Frame f;
+  ez::FrameParser::Event event;
+  while (ez::readFrame(device_, deviceParser_, f, event, timeoutMs_)) {
+    if (event != ez::FrameParser::FrameReady || f.opcode() != ez::Setup)
+      continue;
+    updateSetup(f);
+    deviceReady_ = true;
+    println("Device ready: ez-clang %s, code buffer 0x%08" PRIx64 " (%" PRIu64
+            " bytes, %zu slices)", setup_.version.c_str(), setup_.codeBuffer,
+            setup_.codeBufferSize, clients_.size());
+    executeAsyncAddr_ = lookup("__ez_clang_rpc_execute_async");
+    streamConfigureAddr_ = lookup("__ez_clang_rpc_stream_configure");
+    return true;
+  }
+  return false;
+}
+
+void Mux::onDeviceData(const uint8_t *data, size_t size) {
+  deviceParser_.feed(data, size);
+  ez::Frame f;
+  while (true) {
+    ez::FrameParser::Event event = deviceParser_.next(f);
+    if (event == ez::FrameParser::None)
+      return;
+    if (event == ez::FrameParser::FrameReady)
+      onDeviceFrame(f);
+  }
+}
+
+void Mux::onDeviceFrame(const ez::Frame &f) {
+  switch (f.opcode()) {
+  case ez::Setup:
+    // Device restarted after a Hangup. Clients get it when they reconnect.
+    updateSetup(f);
+    deviceReady_ = true;
+    println("Device restarted");
+    break;
+  case ez::Result:
+  case ez::ResultPart: {
+    if (!inFlight_ || f.seqID() != inFlightSeqID_) {
+      warning(std::string("Dropping unexpected ") + ez::opCodeName(f.opcode()) +
+              " for SeqID " + std::to_string(f.seqID()));
+      break;
+    }
+    if (inFlightClient_ != NoClient) {
+      ez::Frame out = f;
+      out.setSeqID(inFlightClientSeqID_);
+      sendToClient(inFlightClient_, out);
+    }
+    if (f.opcode() == ez::Result)
+      inFlight_ = false;
+    break;
+  }
+  case ez::ReportValue:
+  case ez::ReportString: {
+    // Sequence IDs of reports belong to the JIT code, so they stay as they are
+    size_t target = inFlight_ ? inFlightClient_ : asyncOwner_;
+    if (target != NoClient)
+      sendToClient(target, f);
+    break;
+  }
+  case ez::StreamData:
+    if (streamOwner_ != NoClient)
+      sendToClient(streamOwner_, f);
+    break;
+  case ez::Hangup:
+    // The device session ended for everyone
+    for (size_t i = 0; i < clients_.size(); i += 1) {
+      if (clients_[i].inSession) {
+        sendToClient(i, f);
+        endSession(i);
+      }
+    }
+    queue_.clear();
+    inFlight_ = false;
+    deviceReady_ = false;
+    warning("Device hung up, waiting for it to restart");
+    if (!sendHandshake())
+      exitError("Device write failed");
+    break;
+  default:
+    warning(std::string("Dropping unexpected ") + ez::opCodeName(f.opcode()) +
+            " from device");
+    break;
+  }
+}
+
+// The device handles one message at a time
+void Mux::dispatch() {
+  if (inFlight_ || !deviceReady_ || queue_.empty())
+    return;
+  PendingCall call = std::move(queue_.front());
+  queue_.pop_front();
+
+  inFlight_ = true;
+  inFlightSince_ = Clock::now();
+  inFlightClient_ = call.client;
+  inFlightClientSeqID_ = call.frame.seqID();
+  inFlightSeqID_ = nextSeqID_++;
+  if (nextSeqID_ == 0)
+    nextSeqID_ = 1;
+
+  uint32_t tag = call.frame.tagAddr();
+  if (tag != 0 && tag == executeAsyncAddr_)
+    asyncOwner_ = call.client;
+  if (tag != 0 && tag == streamConfigureAddr_)
+    streamOwner_ = call.client;
+
+  call.frame.setSeqID(inFlightSeqID_);
+  if (!device_.writeFrame(call.frame))
+    exitError("Device write failed");
+}
+
+// Send an error Result to the client. The record uses the code for assertion
+// failures (0), which every host renders with the detail message.
+void Mux::failCall(size_t idx, uint32_t seqID, const std::string &message) {
+  std::vector<uint8_t> payload;
+  payload.push_back(1); // HasError
+  ez::appendUInt64(payload, 5 * 8 + message.size());
+  for (int i = 0; i < 5; i += 1)
+    ez::appendUInt64(payload, 0); // Code and arguments
+  payload.insert(payload.end(), message.begin(), message.end());
+  sendToClient(idx, ez::makeFrame(ez::Result, seqID, 0, payload.data(),
+                                  payload.size()));
+}
+
+// Fail calls that waited too long for the device. The device keeps working
+// on a call in flight, but its client doesn't get the result anymore.
+void Mux::checkTimeouts() {
+  Clock::time_point now = Clock::now();
+  auto expired = [&](Clock::time_point since) {
+    return now - since > std::chrono::milliseconds(timeoutMs_);
+  };
+  std::string message = "ez-mux: no result from the device within " +
+                        std::to_string(timeoutMs_) + "ms";
+  if (inFlight_ && inFlightClient_ != NoClient && expired(inFlightSince_)) {
+    warning("Call " + std::to_string(inFlightSeqID_) + " from client " +
+            std::to_string(inFlightClient_) + " timed out on the device");
+    failCall(inFlightClient_, inFlightClientSeqID_, message);
+    inFlightClient_ = NoClient;
+  }
+  for (auto it = queue_.begin(); it != queue_.end();) {
+    if (!expired(it->enqueued)) {
+      ++it;
+      continue;
+    }
+    warning("Call from client " + std::to_string(it->client) +
+            " timed out in the queue");
+    failCall(it->client, it->frame.seqID(), message);
+    it = queue_.erase(it);
+  }
+}
+
+void Mux::run() {
+  signal(SIGINT, onInterrupt);
+  signal(SIGTERM, onInterrupt);
+  signal(SIGPIPE, SIG_IGN);
+
+  std::vector<pollfd> fds;
+  std::vector<size_t> owners; // Client index for each pollfd after the device
+  uint8_t buffer[4096];
+  while (!g_interrupted) {
+    for (size_t i = 0; i < clients_.size(); i += 1)
+      if (!clients_[i].connected)
+        checkConnect(i);
+      else if (deviceReady_ && clients_[i].wantsSession)
+        startSession(i); // Connected while the device was restarting
+
+    fds.assign(1, pollfd{device_.fd(), POLLIN, 0});
+    owners.clear();
+    for (size_t i = 0; i < clients_.size(); i += 1) {
+      if (clients_[i].connected) {
+        fds.push_back(pollfd{clients_[i].master, POLLIN, 0});
+        owners.push_back(i);
+      }
+    }
+
+    // Short timeout, so we notice new clients and expired calls quickly
+    checkTimeouts();
+    if (poll(fds.data(), fds.size(), 50) <= 0)
+      continue;
+
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      ssize_t n = read(device_.fd(), buffer, sizeof(buffer));
+      if (n <= 0) {
+        warning("Device disconnected");
+        break;
+      }
+      onDeviceData(buffer, n);
+    }
+
+    for (size_t k = 1; k < fds.size(); k += 1) {
+      size_t idx = owners[k - 1];
+      if (fds[k].revents & POLLIN) {
+        ssize_t n = read(clients_[idx].master, buffer, sizeof(buffer));
+        if (n > 0) {
+          onClientData(idx, buffer, n);
+          continue;
+        }
+      }
+      if (fds[k].revents & (POLLHUP | POLLERR))
+        disconnect(idx);
+    }
+
+    dispatch();
+  }
+}
+
+void Mux::shutdown() {
+  for (Client &c : clients_) {
+    std::filesystem::remove(c.linkPath);
+    if (c.master >= 0)
+      close(c.master);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  std::string devicePath;
+  std::string execCommand;
+  std::string linkPath;
+  unsigned baud = 9600;
+  size_t numClients = 4;
+  int timeoutMs = 10000;
+  bool handshake = false;
+
+  for (int i = 1; i < argc; i += 1) {
+    std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc)
+        exitError("Missing value for " + arg);
+      return argv[++i];
+    };
+    if (arg == "--device") {
+      devicePath = value();
+    } else if (arg == "--exec") {
+      execCommand = value();
+    } else if (arg == "--link") {
+      linkPath = value();
+    } else if (arg == "--baud") {
+      baud = std::stoul(value());
+    } else if (arg == "--clients") {
+      numClients = std::stoul(value());
+    } else if (arg == "--handshake") {
+      handshake = true;
+    } else if (arg == "--timeout") {
+      timeoutMs = std::stoi(value());
+    } else if (arg == "-q" || arg == "--quiet") {
+      g_quiet = true;
+    } else {
+      exitError("Unknown option " + arg);
+    }
+  }
+
+  if (linkPath.empty() || numClients == 0 ||
+      devicePath.empty() == execCommand.empty()) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  std::string err;
+  ez::Link link;
+  if (!devicePath.empty()) {
+    if (!ez::openSerial(devicePath, baud, link, err))
+      exitError(err);
+  } else {
+    if (!ez::spawnProcess(execCommand, link, err))
+      exitError(err);
+    handshake = true;
+  }
+
+  Mux mux(link, handshake, timeoutMs);
+  mux.createClients(linkPath, numClients);
+  if (!mux.waitForDevice())
+    exitError("No Setup message from device");
+
+  println("Serving %zu clients on %s-0 to %s-%zu (Ctrl+C to stop)", numClients,
+          linkPath.c_str(), linkPath.c_str(), numClients - 1);
+  mux.run();
+  mux.shutdown();
+  return 0;
+}
@@ -0,0 +1,694 @@
+// Record and replay ez-clang RPC sessions
+//
+// Build: g++ -std=c++17 -O2 -o ez-trace tools/ez-trace.cc
+//
+// record: Create a pseudo-terminal (--link) for the REPL to connect to and
+//         forward all traffic to the device, while storing each frame with its
+//         timestamp in a trace file.
+// replay: Send the recorded host frames to a device (--device) or a process
+//         (--exec, e.g. the host variant of the firmware), either at maximum
+//         rate or with the original timing. Reports throughput and per-endpoint
+//         latency percentiles and flags responses that differ from the trace.
+//         With --tick-stats, it also queries the on-device cycles per request
+//         for each session, e.g. to compare firmware builds.
+// dump:   Print the contents of a trace file.
+// stream: Decode the telemetry records from StreamData messages in a trace file
+//         and write them to stdout, as hex lines or raw binary (--format raw).
+//
+#include "ez-link.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <csignal>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+enum RecordKind : uint8_t {
+  HostMagic,
+  DeviceMagic,
+  HostFrame,
+  DeviceFrame,
+};
+
+// Trace files start with this magic, followed by a sequence of records:
+// kind (1 byte), timestamp in ns (8 bytes), size (4 bytes), frame bytes
+static const char TraceMagic[8] = {'E', 'Z', 'T', 'R', 'A', 'C', 'E', 1};
+
+struct TraceRecord {
+  RecordKind kind;
+  uint64_t timeNs;
+  ez::Frame frame; // Empty for magic records
+};
+
+void exitError(std::string message) {
+  fprintf(stderr, "Error: %s\n", message.c_str());
+  exit(1);
+}
+
+void warning(std::string message) {
+  fprintf(stderr, "Warning: %s\n", message.c_str());
+}
+
+bool g_quiet = false;
+
+int println(const char *__restrict fmt, ...) {
+  if (g_quiet)
+    return 0;
+  va_list args;
+  va_start(args, fmt);
+  int len = vprintf(fmt, args);
+  va_end(args);
+  putchar('\n');
+  return len;
+}
+
+void printUsage(const char *argv0) {
+  fprintf(stderr, "Record and replay ez-clang RPC sessions\n");
+  fprintf(stderr, "Usage: %s record --device <tty> --link <path> [--baud <rate>] <trace>\n", argv0);
+  fprintf(stderr, "       %s replay (--device <tty> | --exec <cmd>) [--baud <rate>] [--timing max|original]\n"
+                  "       %*s [--repeat <n>] [--timeout <ms>] [--tick-stats] [-q] <trace>\n", argv0, (int)strlen(argv0), "");
+  fprintf(stderr, "       %s dump <trace>\n", argv0);
+  fprintf(stderr, "       %s stream [--format hex|raw] <trace>\n", argv0);
+}
+
+//
+// Trace file I/O
+//
+void writeRecord(std::ofstream &os, const TraceRecord &rec) {
+  uint8_t head[1 + 8 + 4];
+  head[0] = rec.kind;
+  ez::writeLE64(head + 1, rec.timeNs);
+  uint32_t size = rec.frame.bytes.size();
+  for (int i = 0; i < 4; i += 1)
+    head[9 + i] = static_cast<uint8_t>(size >> (8 * i));
+  os.write(reinterpret_cast<const char *>(head), sizeof(head));
+  os.write(reinterpret_cast<const char *>(rec.frame.bytes.data()), size);
+}
+
+std::vector<TraceRecord> loadTrace(const std::filesystem::path &filepath) {
+  std::ifstream ifs(filepath, std::ios::binary);
+  if (!ifs)
+    exitError(filepath.string() + " (" + std::strerror(errno) + ")");
+
+  char magic[sizeof(TraceMagic)];
+  if (!ifs.read(magic, sizeof(magic)) || memcmp(magic, TraceMagic, sizeof(magic)) != 0)
+    exitError(filepath.string() + " is not an ez-trace file");
+
+  std::vector<TraceRecord> records;
+  uint8_t head[1 + 8 + 4];
+  while (ifs.read(reinterpret_cast<char *>(head), sizeof(head))) {
+    TraceRecord rec;
+    rec.kind = static_cast<RecordKind>(head[0]);
+    rec.timeNs = ez::readLE64(head + 1);
+    uint32_t size = head[9] | head[10] << 8 | head[11] << 16 | head[12] << 24;
+    rec.frame.bytes.resize(size);
+    if (!ifs.read(reinterpret_cast<char *>(rec.frame.bytes.data()), size))
+      exitError(filepath.string() + " (truncated record)");
+    if (rec.kind > DeviceFrame)
+      exitError(filepath.string() + " (invalid record kind)");
+    if ((rec.kind == HostFrame || rec.kind == DeviceFrame) &&
+        size < ez::MessageHeaderSize)
+      exitError(filepath.string() + " (invalid frame size)");
+    records.push_back(std::move(rec));
+  }
+  return records;
+}
+
+//
+// Endpoint names are collected from the bootstrap symbols in the Setup message
+// and from lookup calls and their results.
+//
+std::map<uint32_t, std::string> collectEndpointNames(const std::vector<TraceRecord> &records) {
+  std::map<uint32_t, std::string> names;
+  std::map<uint32_t, std::vector<std::string>> lookupsBySeqID;
+  std::vector<uint32_t> lookupAddrs;
+
+  for (const TraceRecord &rec : records) {
+    if (rec.kind != HostFrame && rec.kind != DeviceFrame)
+      continue;
+    const ez::Frame &f = rec.frame;
+    const uint8_t *data = f.payload();
+    const uint8_t *end = data + f.payloadSize();
+
+    if (rec.kind == DeviceFrame && f.opcode() == ez::Setup) {
+      std::string version;
+      uint64_t codeBuffer, codeBufferSize, numSymbols;
+      if (!ez::parseString(data, end, version) ||
+          !ez::parseUInt64(data, end, codeBuffer) ||
+          !ez::parseUInt64(data, end, codeBufferSize) ||
+          !ez::parseUInt64(data, end, numSymbols))
+        continue;
+      for (uint64_t i = 0; i < numSymbols; i += 1) {
+        std::string name;
+        uint64_t addr;
+        if (!ez::parseString(data, end, name) || !ez::parseUInt64(data, end, addr))
+          break;
+        names[addr] = name;
+        if (name == "__ez_clang_rpc_lookup")
+          lookupAddrs.push_back(addr);
+      }
+    } else if (rec.kind == HostFrame && f.opcode() == ez::Call &&
+               std::count(lookupAddrs.begin(), lookupAddrs.end(), f.tagAddr())) {
+      uint64_t count;
+      if (!ez::parseUInt64(data, end, count))
+        continue;
+      std::vector<std::string> requested;
+      for (uint64_t i = 0; i < count; i += 1) {
+        std::string name;
+        if (!ez::parseString(data, end, name))
+          break;
+        requested.push_back(std::move(name));
+      }
+      lookupsBySeqID[f.seqID()] = std::move(requested);
+    } else if (rec.kind == DeviceFrame && f.opcode() == ez::Result) {
+      auto it = lookupsBySeqID.find(f.seqID());
+      if (it == lookupsBySeqID.end())
+        continue;
+      uint64_t count;
+      if (end - data < 1 || data[0] != 0) // HasError
+        continue;
+      data += 1;
+      if (!ez::parseUInt64(data, end, count))
+        continue;
+      for (uint64_t i = 0; i < count && i < it->second.size(); i += 1) {
+        uint64_t addr;
+        if (!ez::parseUInt64(data, end, addr))
+          break;
+        if (addr != 0)
+          names[addr] = it->second[i];
+      }
+      lookupsBySeqID.erase(it);
+    }
+  }
+  return names;
+}
+
+std::string endpointName(const std::map<uint32_t, std::string> &names, uint32_t addr) {
+  auto it = names.find(addr);
+  if (it != names.end())
+    return it->second;
+  char buffer[16];
+  snprintf(buffer, sizeof(buffer), "0x%08" PRIx32, addr);
+  return buffer;
+}
+
+//
+// record
+//
+volatile sig_atomic_t g_interrupted = 0;
+
+void onInterrupt(int) { g_interrupted = 1; }
+
+int cmdRecord(ez::Link &device, const std::string &linkPath,
+              const std::filesystem::path &tracePath) {
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    exitError(std::string("Cannot create pseudo-terminal (") + std::strerror(errno) + ")");
+  const char *slaveName = ptsname(master);
+
+  // Keep the slave side open, so the master doesn't see EIO between sessions
+  int slave = open(slaveName, O_RDWR | O_NOCTTY);
+  termios tio;
+  if (slave >= 0 && tcgetattr(slave, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+  }
+
+  std::filesystem::remove(linkPath);
+  if (symlink(slaveName, linkPath.c_str()) != 0)
+    exitError("Cannot create link " + linkPath + " (" + std::strerror(errno) + ")");
+
+  std::ofstream trace(tracePath, std::ios::binary);
+  if (!trace)
+    exitError(tracePath.string() + " (" + std::strerror(errno) + ")");
+  trace.write(TraceMagic, sizeof(TraceMagic));
+
+  println("Recording session: connect to %s (Ctrl+C to stop)", linkPath.c_str());
+  signal(SIGINT, onInterrupt);
+  signal(SIGTERM, onInterrupt);
+
+  ez::FrameParser hostParser(false);
+  hostParser.resyncOnHangup(false);
+  ez::FrameParser deviceParser(true);
+  ez::Clock::time_point start = ez::Clock::now();
+  size_t numFrames = 0;
+
+  auto drain = [&](ez::FrameParser &parser, RecordKind magicKind, RecordKind frameKind) {
+    TraceRecord rec;
+    while (true) {
+      ez::FrameParser::Event event = parser.next(rec.frame);
+      if (event == ez::FrameParser::None)
+        return;
+      rec.timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          ez::Clock::now() - start).count();
+      rec.kind = event == ez::FrameParser::Magic ? magicKind : frameKind;
+      if (event == ez::FrameParser::Magic)
+        rec.frame.bytes.clear();
+      else
+        numFrames += 1;
+      writeRecord(trace, rec);
+    }
+  };
+
+  pollfd fds[2] = {{master, POLLIN, 0}, {device.fd(), POLLIN, 0}};
+  uint8_t buffer[4096];
+  while (!g_interrupted) {
+    if (poll(fds, 2, 200) <= 0)
+      continue;
+    if (fds[0].revents & POLLIN) {
+      ssize_t n = read(master, buffer, sizeof(buffer));
+      if (n > 0) {
+        if (!device.writeAll(buffer, n))
+          exitError("Device write failed");
+        hostParser.feed(buffer, n);
+        drain(hostParser, HostMagic, HostFrame);
+      }
+    }
+    if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+      ssize_t n = read(device.fd(), buffer, sizeof(buffer));
+      if (n <= 0) {
+        warning("Device disconnected");
+        break;
+      }
+      for (ssize_t written = 0; written < n;) {
+        ssize_t w = write(master, buffer + written, n - written);
+        if (w <= 0)
+          break;
+        written += w;
+      }
+      deviceParser.feed(buffer, n);
+      drain(deviceParser, DeviceMagic, DeviceFrame);
+    }
+  }
+
+  trace.close();
+  std::filesystem::remove(linkPath);
+  if (slave >= 0)
+    close(slave);
+  close(master);
+  println("Recorded %zu frames to %s", numFrames, tracePath.c_str());
+  return 0;
+}
+
+//
+// replay
+//
+struct EndpointStats {
+  std::vector<double> latenciesUs;
+};
+
+double percentile(std::vector<double> &sorted, double p) {
+  if (sorted.empty())
+    return 0.0;
+  size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+  return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+struct ReplayOptions {
+  bool originalTiming = false;
+  bool tickStats = false;
+  unsigned repeat = 1;
+  int timeoutMs = 5000;
+};
+
+// Calls that we inject into a replayed session use sequence IDs from the top
+// of the range, so they can't collide with recorded ones
+constexpr uint32_t InjectedSeqID = 0xFFFFFF00;
+
+// Call an endpoint outside the recorded stream and wait for its result
+bool callInjected(ez::Link &link, ez::FrameParser &parser, uint32_t tagAddr,
+                  const std::vector<uint8_t> &payload, int timeoutMs,
+                  ez::Frame &result) {
+  ez::Frame call = ez::makeFrame(ez::Call, InjectedSeqID, tagAddr,
+                                 payload.data(), payload.size());
+  if (!link.writeFrame(call))
+    return false;
+  ez::FrameParser::Event event;
+  while (ez::readFrame(link, parser, result, event, timeoutMs)) {
+    if (event == ez::FrameParser::FrameReady && result.opcode() == ez::Result &&
+        result.seqID() == InjectedSeqID)
+      return true;
+  }
+  return false;
+}
+
+// Find the device address of __ez_clang_rpc_tick_stats through the lookup
+// endpoint from the Setup message. Returns 0 if the firmware doesn't have it.
+uint32_t lookupTickStats(ez::Link &link, ez::FrameParser &parser,
+                         const ez::Frame &setup, int timeoutMs) {
+  const uint8_t *data = setup.payload();
+  const uint8_t *end = data + setup.payloadSize();
+  std::string version;
+  uint64_t codeBuffer, codeBufferSize, numSymbols, lookupAddr = 0;
+  if (!ez::parseString(data, end, version) || !ez::parseUInt64(data, end, codeBuffer) ||
+      !ez::parseUInt64(data, end, codeBufferSize) || !ez::parseUInt64(data, end, numSymbols))
+    return 0;
+  for (uint64_t i = 0; i < numSymbols; i += 1) {
+    std::string name;
+    uint64_t addr;
+    if (!ez::parseString(data, end, name) || !ez::parseUInt64(data, end, addr))
+      return 0;
+    if (name == "__ez_clang_rpc_lookup")
+      lookupAddr = addr;
+  }
+  if (lookupAddr == 0)
+    return 0;
+
+  const std::string name = "__ez_clang_rpc_tick_stats";
+  std::vector<uint8_t> payload(8 + 8 + name.size());
+  ez::writeLE64(payload.data(), 1);
+  ez::writeLE64(payload.data() + 8, name.size());
+  memcpy(payload.data() + 16, name.data(), name.size());
+  ez::Frame result;
+  if (!callInjected(link, parser, lookupAddr, payload, timeoutMs, result))
+    return 0;
+  data = result.payload();
+  end = data + result.payloadSize();
+  uint64_t count, addr;
+  if (end - data < 1 || data[0] != 0)
+    return 0;
+  data += 1;
+  if (!ez::parseUInt64(data, end, count) || count != 1 || !ez::parseUInt64(data, end, addr))
+    return 0;
+  return addr;
+}
+
+// Read and reset the cycles per request on the device
+void reportTickStats(ez::Link &link, ez::FrameParser &parser, uint32_t tickStatsAddr,
+                     int timeoutMs) {
+  ez::Frame result;
+  if (!callInjected(link, parser, tickStatsAddr, {1}, timeoutMs, result)) {
+    warning("No response from __ez_clang_rpc_tick_stats");
+    return;
+  }
+  const uint8_t *data = result.payload();
+  const uint8_t *end = data + result.payloadSize();
+  uint64_t freq, ticks, minCycles, maxCycles, meanCycles;
+  if (end - data < 2 || data[0] != 0)
+    return;
+  bool hotPathInRAM = data[1] != 0;
+  data += 2;
+  if (!ez::parseUInt64(data, end, freq) || !ez::parseUInt64(data, end, ticks) ||
+      !ez::parseUInt64(data, end, minCycles) || !ez::parseUInt64(data, end, maxCycles) ||
+      !ez::parseUInt64(data, end, meanCycles))
+    return;
+  println("Device: %" PRIu64 " requests, cycles min %" PRIu64 " mean %" PRIu64
+          " max %" PRIu64 " @ %.1f MHz (hot path in %s)", ticks, minCycles,
+          meanCycles, maxCycles, freq / 1e6, hotPathInRAM ? "SRAM" : "flash");
+}
+
+int cmdReplay(ez::Link &link, const std::vector<TraceRecord> &records,
+              const ReplayOptions &opts) {
+  std::map<uint32_t, std::string> names = collectEndpointNames(records);
+  std::map<uint32_t, EndpointStats> stats;
+
+  struct Pending {
+    ez::Clock::time_point sent;
+    uint32_t endpoint;
+  };
+
+  size_t numCalls = 0;
+  size_t numBytes = 0;
+  size_t numMismatches = 0;
+  constexpr size_t MaxMismatchesShown = 10;
+  ez::Clock::time_point replayStart = ez::Clock::now();
+
+  for (unsigned rep = 0; rep < opts.repeat; rep += 1) {
+    ez::FrameParser parser(true);
+    std::map<uint32_t, Pending> pending;
+    uint32_t tickStatsAddr = 0;
+    ez::Clock::time_point start = ez::Clock::now();
+    uint64_t traceStart = records.empty() ? 0 : records.front().timeNs;
+
+    auto waitForTimestamp = [&](uint64_t timeNs) {
+      if (opts.originalTiming)
+        std::this_thread::sleep_until(start + std::chrono::nanoseconds(timeNs - traceStart));
+    };
+
+    for (size_t i = 0; i < records.size(); i += 1) {
+      const TraceRecord &rec = records[i];
+      switch (rec.kind) {
+      case HostMagic: {
+        waitForTimestamp(rec.timeNs);
+        const uint8_t *magic = reinterpret_cast<const uint8_t *>(&ez::SetupMagic);
+        if (!link.writeAll(magic, sizeof(ez::SetupMagic)))
+          exitError("Link write failed");
+        break;
+      }
+      case HostFrame: {
+        waitForTimestamp(rec.timeNs);
+        if (rec.frame.opcode() == ez::Hangup && tickStatsAddr != 0) {
+          reportTickStats(link, parser, tickStatsAddr, opts.timeoutMs);
+          tickStatsAddr = 0;
+        }
+        if (rec.frame.opcode() == ez::Call)
+          pending[rec.frame.seqID()] = Pending{ez::Clock::now(), rec.frame.tagAddr()};
+        if (!link.writeFrame(rec.frame))
+          exitError("Link write failed");
+        numBytes += rec.frame.bytes.size();
+        break;
+      }
+      case DeviceMagic:
+      case DeviceFrame: {
+        ez::Frame actual;
+        ez::FrameParser::Event event;
+        if (!ez::readFrame(link, parser, actual, event, opts.timeoutMs))
+          exitError("Timeout waiting for record " + std::to_string(i) +
+                    " (" + (rec.kind == DeviceMagic ? "handshake" :
+                            ez::opCodeName(rec.frame.opcode())) + ")");
+        bool expectMagic = rec.kind == DeviceMagic;
+        if (expectMagic != (event == ez::FrameParser::Magic))
+          exitError("Stream diverged at record " + std::to_string(i) +
+                    (expectMagic ? ": expected handshake" : ": unexpected handshake"));
+        if (expectMagic)
+          break;
+
+        numBytes += actual.bytes.size();
+        if (actual.bytes != rec.frame.bytes) {
+          numMismatches += 1;
+          if (numMismatches <= MaxMismatchesShown) {
+            size_t offset = 0;
+            size_t common = std::min(actual.bytes.size(), rec.frame.bytes.size());
+            while (offset < common && actual.bytes[offset] == rec.frame.bytes[offset])
+              offset += 1;
+            warning(std::string("Response differs from recording: ") +
+                    ez::opCodeName(actual.opcode()) + " SeqID " +
+                    std::to_string(actual.seqID()) + " at byte " +
+                    std::to_string(offset));
+          }
+        }
+
+        if (actual.opcode() == ez::Setup && opts.tickStats) {
+          // Start counting with the first recorded request
+          tickStatsAddr = lookupTickStats(link, parser, actual, opts.timeoutMs);
+          ez::Frame reset;
+          if (tickStatsAddr == 0)
+            warning("Firmware doesn't provide __ez_clang_rpc_tick_stats");
+          else if (!callInjected(link, parser, tickStatsAddr, {1}, opts.timeoutMs, reset))
+            tickStatsAddr = 0;
+        }
+
+        if (actual.opcode() == ez::Result) {
+          auto it = pending.find(actual.seqID());
+          if (it != pending.end()) {
+            double us = std::chrono::duration<double, std::micro>(
+                ez::Clock::now() - it->second.sent).count();
+            stats[it->second.endpoint].latenciesUs.push_back(us);
+            numCalls += 1;
+            pending.erase(it);
+          }
+        }
+        break;
+      }
+      }
+    }
+  }
+
+  double seconds = std::chrono::duration<double>(ez::Clock::now() - replayStart).count();
+  println("Replayed %zu calls in %.3f s: %.1f calls/s, %.1f KiB/s",
+          numCalls, seconds, numCalls / seconds, numBytes / 1024.0 / seconds);
+  println("%-36s %8s %10s %10s %10s", "Endpoint", "Calls", "p50 us", "p99 us", "p999 us");
+  for (auto &entry : stats) {
+    std::vector<double> &lat = entry.second.latenciesUs;
+    std::sort(lat.begin(), lat.end());
+    println("%-36s %8zu %10.1f %10.1f %10.1f", endpointName(names, entry.first).c_str(),
+            lat.size(), percentile(lat, 0.50), percentile(lat, 0.99),
+            percentile(lat, 0.999));
+  }
+
+  if (numMismatches > 0) {
+    fprintf(stderr, "%zu responses differ from the recording\n", numMismatches);
+    return 2;
+  }
+  println("All responses match the recording");
+  return 0;
+}
+
+//
+// dump
+//
+int cmdDump(const std::vector<TraceRecord> &records) {
+  std::map<uint32_t, std::string> names = collectEndpointNames(records);
+  for (const TraceRecord &rec : records) {
+    double ms = rec.timeNs / 1e6;
+    switch (rec.kind) {
+    case HostMagic:
+      printf("%12.3f ms  host   handshake\n", ms);
+      break;
+    case DeviceMagic:
+      printf("%12.3f ms  device handshake\n", ms);
+      break;
+    case HostFrame:
+    case DeviceFrame: {
+      const ez::Frame &f = rec.frame;
+      printf("%12.3f ms  %s %-12s seq %-6" PRIu32 " %6zu bytes", ms,
+             rec.kind == HostFrame ? "host  " : "device", ez::opCodeName(f.opcode()),
+             f.seqID(), f.bytes.size());
+      if (f.opcode() == ez::Call)
+        printf("  %s", endpointName(names, f.tagAddr()).c_str());
+      printf("\n");
+      break;
+    }
+    }
+  }
+  return 0;
+}
+
+//
+// stream
+//
+int cmdStream(const std::vector<TraceRecord> &records, bool raw) {
+  ez::StreamDecoder decoder;
+  size_t malformed = 0;
+  for (const TraceRecord &rec : records) {
+    if (rec.kind != DeviceFrame || rec.frame.opcode() != ez::StreamData)
+      continue;
+    const ez::Frame &f = rec.frame;
+    bool valid = decoder.feed(f.payload(), f.payloadSize(),
+                              [raw](uint64_t index, const uint8_t *data, size_t size) {
+      if (raw) {
+        fwrite(data, 1, size, stdout);
+        return;
+      }
+      printf("%10" PRIu64 " ", index);
+      for (size_t i = 0; i < size; i += 1)
+        printf(" %02x", data[i]);
+      printf("\n");
+    });
+    if (!valid)
+      malformed += 1;
+  }
+  fflush(stdout);
+  fprintf(stderr, "%" PRIu64 " records of %" PRIu64 " bytes in %" PRIu64
+                  " chunks, %" PRIu64 " dropped on the device, %" PRIu64
+                  " lost on the link\n",
+          decoder.records(), decoder.recordSize(), decoder.chunks(),
+          decoder.dropped(), decoder.lost());
+  if (malformed > 0)
+    warning(std::to_string(malformed) + " malformed StreamData messages");
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  std::string command = argv[1];
+  std::string devicePath;
+  std::string execCommand;
+  std::string linkPath;
+  std::filesystem::path tracePath;
+  unsigned baud = 9600;
+  ReplayOptions opts;
+  bool rawStream = false;
+
+  for (int i = 2; i < argc; i += 1) {
+    std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc)
+        exitError("Missing value for " + arg);
+      return argv[++i];
+    };
+    if (arg == "--device") {
+      devicePath = value();
+    } else if (arg == "--exec") {
+      execCommand = value();
+    } else if (arg == "--link") {
+      linkPath = value();
+    } else if (arg == "--baud") {
+      baud = std::stoul(value());
+    } else if (arg == "--timing") {
+      std::string timing = value();
+      if (timing != "max" && timing != "original")
+        exitError("Invalid timing '" + timing + "' (expected max or original)");
+      opts.originalTiming = timing == "original";
+    } else if (arg == "--repeat") {
+      opts.repeat = std::stoul(value());
+    } else if (arg == "--timeout") {
+      opts.timeoutMs = std::stoi(value());
+    } else if (arg == "--format") {
+      std::string format = value();
+      if (format != "hex" && format != "raw")
+        exitError("Invalid format '" + format + "' (expected hex or raw)");
+      rawStream = format == "raw";
+    } else if (arg == "--tick-stats") {
+      opts.tickStats = true;
+    } else if (arg == "-q" || arg == "--quiet") {
+      g_quiet = true;
+    } else if (!arg.empty() && arg[0] == '-') {
+      exitError("Unknown option " + arg);
+    } else {
+      tracePath = arg;
+    }
+  }
+
+  if (tracePath.empty()) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  if (command == "dump")
+    return cmdDump(loadTrace(tracePath));
+  if (command == "stream")
+    return cmdStream(loadTrace(tracePath), rawStream);
+
+  std::string err;
+  ez::Link link;
+  if (!devicePath.empty()) {
+    if (!ez::openSerial(devicePath, baud, link, err))
+      exitError(err);
+  } else if (!execCommand.empty() && command == "replay") {
+    if (!ez::spawnProcess(execCommand, link, err))
+      exitError(err);
+  } else {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  if (command == "record") {
+    if (linkPath.empty())
+      exitError("record requires --link <path>");
+    return cmdRecord(link, linkPath, tracePath);
+  }
+  if (command == "replay")
+    return cmdReplay(link, loadTrace(tracePath), opts);
+
+  printUsage(argv[0]);
+  return 1;
+}